@@ -3,6 +3,7 @@
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/vmalloc.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -63,7 +64,8 @@ fat_open (void) {
 	{
 		printf("fat_open\n");	
 	}
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
+	// The FAT can span many pages; it only needs to be virtually contiguous
+	fat_fs->fat = vmalloc (fat_fs->fat_length * sizeof (cluster_t), PAL_ZERO);
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT load failed");
 
@@ -138,7 +140,8 @@ fat_create (void) {
 	fat_fs_init ();
 
 	// Create FAT table
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
+	// The FAT can span many pages; it only needs to be virtually contiguous
+	fat_fs->fat = vmalloc (fat_fs->fat_length * sizeof (cluster_t), PAL_ZERO);
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT creation failed");
 
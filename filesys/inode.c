@@ -10,6 +10,9 @@
 #include "filesys/directory.h"
 #include "filesys/page_cache.h"
 #include "filesys/inode.h"
+#ifdef VM
+#include "vm/trace.h"
+#endif
 
 #define LOG 0
 /* END */
@@ -23,8 +26,10 @@ struct inode_disk {
 	disk_sector_t start;                /* First data sector. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
+	uint32_t version;                   /* Bumped by every write, stands
+	                                       in for a modification time. */
 
-	uint32_t unused[124];               /* Not used. */
+	uint32_t unused[123];               /* Not used. */
 
 	bool is_dir;						/* This is directory or not */
 };
@@ -47,7 +52,7 @@ struct inode {
 	/* Our Implementation */
 	bool is_sym;
 	int device_info;					/* For Mount */
-	struct lock *fat_lock;				/* Lock when accessing FAT */
+	struct lock fat_lock;				/* Lock when accessing FAT */
 };
 
 /* For Debug */
@@ -71,7 +76,8 @@ byte_to_sector (const struct inode *inode, off_t pos) {
 	// for문으로 pos / DISK_SECTOR_SIZE 만큼 돌면서
 	// FAT을 traverse하는 코드
 
-	lock_acquire(&inode->fat_lock);
+	struct lock *fat_lock = (struct lock *) &inode->fat_lock;
+	lock_acquire(fat_lock);
 
 	disk_sector_t start = inode->data.start;
 	cluster_t temp = (cluster_t) start;
@@ -80,14 +86,14 @@ byte_to_sector (const struct inode *inode, off_t pos) {
 
 	if (pos >= inode->data.length)
 	{
-		lock_release(&inode->fat_lock);
+		lock_release(fat_lock);
 		return -1;
 	}
 	while(cnt--)
 	{
 		temp = fat_get(temp);
 	}
-	lock_release(&inode->fat_lock);
+	lock_release(fat_lock);
 
 	return cluster_to_sector(temp);
 }
@@ -128,6 +134,11 @@ inode_create (disk_sector_t sector, off_t length, bool is_dir) {
 	 * one sector in size, and you should fix that. */
 	ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
 
+#ifdef VM
+	/* A program still running when its file was removed may have stored
+	 * a trace since: the sector is reused now. */
+	vm_trace_forget (sector);
+#endif
 	disk_inode = calloc (1, sizeof *disk_inode);
 	if (disk_inode != NULL) {
 		size_t sectors = bytes_to_sectors (length);
@@ -281,6 +292,9 @@ inode_remove (struct inode *inode) {
 	}
 	ASSERT (inode != NULL);
 	inode->removed = true;
+#ifdef VM
+	vm_trace_forget (inode->sector);
+#endif
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -512,6 +526,9 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 	}
 	free (bounce);
 	// printf("finish inode_write_at\n");
+	// Written back with the rest of DATA by inode_close()
+	if (bytes_written > 0)
+		inode->data.version++;
 
 	if (inode->is_sym == true)
 	{
@@ -547,6 +564,13 @@ inode_allow_write (struct inode *inode) {
 	inode->deny_write_cnt--;
 }
 
+/* Returns the write version of INODE, which changes whenever its data
+ * does. */
+uint32_t
+inode_version (const struct inode *inode) {
+	return inode->data.version;
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode) {
@@ -581,6 +605,27 @@ inode_is_removed (struct inode *inode)
    return inode->removed;
 }
 
+/* Returns true if every sector holding the SIZE bytes of INODE
+   starting at OFFSET is in the page cache, so that reading them
+   takes no disk I/O. Used by fault-around. */
+bool
+inode_is_cached (struct inode *inode, off_t offset, off_t size)
+{
+	off_t pos;
+
+	for (pos = offset - offset % DISK_SECTOR_SIZE; pos < offset + size;
+			pos += DISK_SECTOR_SIZE)
+	{
+		disk_sector_t sector_idx = byte_to_sector (inode, pos);
+
+		if (sector_idx == -1)
+			return false;
+		if (!page_cache_contains (fat_to_data_cluster(sector_idx)))
+			return false;
+	}
+	return true;
+}
+
 /* Returns inode_disk for corresponding sector number. 
    Used in symlink implementation */
 struct inode_disk *data_open (disk_sector_t sector)
@@ -155,6 +155,18 @@ page_cache_evict (void)
 	return victim;
 }
 
+/* Return true if sector SEC_NO is held in the page cache, so that
+   reading it costs no disk I/O */
+bool page_cache_contains (disk_sector_t sec_no)
+{
+	bool found;
+
+	lock_acquire (&page_cache_lock);
+	found = page_cache_lookup (sec_no) != NULL;
+	lock_release (&page_cache_lock);
+	return found;
+}
+
 /* disk_read with page cache support */
 void page_cache_read (struct disk *d, disk_sector_t sec_no, const void *buffer)
 {
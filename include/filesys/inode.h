@@ -2,6 +2,7 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "filesys/off_t.h"
 #include "devices/disk.h"
 
@@ -17,10 +18,12 @@ off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+uint32_t inode_version (const struct inode *);
 
 /* Our Implementation */
 bool inode_is_dir (const struct inode *inode);
 bool inode_is_removed (struct inode *inode);
+bool inode_is_cached (struct inode *inode, off_t offset, off_t size);
 
 // For Debug
 int deny_cnt (struct inode *inode); 
@@ -36,6 +36,8 @@ void page_cache_destroy (void);
 // Replace disk_read and disk_write
 void page_cache_read (struct disk *d, disk_sector_t sec_no, const void *buffer);
 void page_cache_write (struct disk *d, disk_sector_t sec_no, const void *buffer);
+// For fault-around
+bool page_cache_contains (disk_sector_t sec_no);
 /* END */
 
 #endif
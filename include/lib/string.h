@@ -25,6 +25,18 @@ size_t strlcat (char *, const char *, size_t);
 char *strtok_r (char *, const char *, char **);
 size_t strnlen (const char *, size_t);
 
+/* Small blocks whose size is a compile-time constant (struct
+   copies, fixed headers, ...) are expanded inline by the compiler
+   instead of paying for a call.  Parenthesize the name, as in
+   (memcpy) (...), to always get the out-of-line version. */
+#define STRING_INLINE_MAX 32
+#define memcpy(DST, SRC, SIZE) \
+	(__builtin_constant_p (SIZE) && (SIZE) <= STRING_INLINE_MAX \
+	 ? __builtin_memcpy (DST, SRC, SIZE) : memcpy (DST, SRC, SIZE))
+#define memset(DST, VALUE, SIZE) \
+	(__builtin_constant_p (SIZE) && (SIZE) <= STRING_INLINE_MAX \
+	 ? __builtin_memset (DST, VALUE, SIZE) : memset (DST, VALUE, SIZE))
+
 /* Try to be helpful. */
 #define strcpy dont_use_strcpy_use_strlcpy
 #define strncpy dont_use_strncpy_use_strlcpy
@@ -36,6 +36,10 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Extra for Project 3 */
+	SYS_MADVISE,                /* Advise how memory will be accessed. */
+	SYS_SPAWN,                  /* Start a program in a new process. */
 };
 
 #endif /* lib/syscall-nr.h */
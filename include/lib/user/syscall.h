@@ -13,6 +13,16 @@ typedef int pid_t;
 typedef int off_t;
 #define MAP_FAILED ((void *) NULL)
 
+/* Hints for madvise(). */
+#define MADV_NORMAL     0       /* No special treatment. */
+#define MADV_RANDOM     1       /* Expect random access. */
+#define MADV_SEQUENTIAL 2       /* Expect sequential access. */
+#define MADV_WILLNEED   3       /* Will be accessed soon. */
+#define MADV_DONTNEED   4       /* Not needed any more. */
+
+/* Maximum file descriptors passed to spawn(). */
+#define SPAWN_MAX_FDS 32
+
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
@@ -37,10 +47,12 @@ unsigned tell (int fd);
 void close (int fd);
 
 int dup2(int oldfd, int newfd);
+pid_t spawn (const char *cmd_line, const int *fds, size_t fd_cnt);
 
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
+int madvise (void *addr, size_t length, int advice);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
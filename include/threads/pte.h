@@ -41,5 +41,15 @@
 #define PTE_U 0x4                        /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20                       /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40                       /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80                      /* 1=2 MB page (PDEs only). */
+#define PTE_G 0x100                      /* 1=global, kept across CR3 loads. */
+
+/* Huge (2 MB) pages, mapped directly by a page-directory entry. */
+#define HPGSIZE (1UL << PDXSHIFT)        /* Bytes in a huge page. */
+#define HPGMASK (HPGSIZE - 1)            /* Huge page offset bits. */
+#define HPG_PAGE_CNT (HPGSIZE / PGSIZE)  /* Normal pages in a huge page. */
+
+/* Round down to nearest huge page boundary. */
+#define hpg_round_down(va) ((void *) ((uint64_t) (va) & ~HPGMASK))
 
 #endif /* threads/pte.h */
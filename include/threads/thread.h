@@ -124,13 +124,14 @@ struct thread {
 	struct semaphore filecopy_sema;
 	bool filecopy_success;
 	int exit_status;
+	void *user_rsp;                     /* User stack pointer at the last
+	                                       system call */
 
 	uint64_t *pml4;                     /* Page map level 4 */
 #endif
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
-	struct list mmap_list;
 #endif
 	struct dir *cur_dir;
 
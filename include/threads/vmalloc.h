@@ -0,0 +1,22 @@
+#ifndef THREADS_VMALLOC_H
+#define THREADS_VMALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Window of kernel virtual memory that vmalloc() maps pages
+   into.  It lies in the same PML4 slot as KERN_BASE. */
+#define VMALLOC_START ((void *) 0xc000000000)
+#define VMALLOC_PAGES (64 * 1024)       /* 256 MB. */
+#define VMALLOC_END ((void *) ((uint8_t *) VMALLOC_START \
+			+ (size_t) VMALLOC_PAGES * PGSIZE))
+
+void vmalloc_init (void);
+void *vmalloc (size_t size, enum palloc_flags);
+void vfree (void *);
+bool is_vmalloc_addr (const void *);
+
+#endif /* threads/vmalloc.h */
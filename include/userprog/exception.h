@@ -6,7 +6,19 @@
 #define PF_W 0x2    /* 0: read, 1: write. */
 #define PF_U 0x4    /* 0: kernel, 1: user process. */
 
+#include <stddef.h>
+#include <stdint.h>
+
+struct intr_frame;
+
 void exception_init (void);
 void exception_print_stats (void);
+uint64_t exception_fixup_of (uint64_t rip);
+
+/* Copies to and from user memory that fail instead of faulting on a bad
+ * user address, in usercopy.S. */
+size_t copy_from_user (void *dst, const void *usrc, size_t n);
+size_t copy_to_user (void *udst, const void *src, size_t n);
+long strncpy_from_user (char *dst, const char *usrc, size_t n);
 
 #endif /* userprog/exception.h */
@@ -7,6 +7,7 @@
 tid_t process_create_initd (const char *file_name);
 tid_t process_fork (const char *name, struct thread_and_if *tif UNUSED);
 int process_exec (void *f_name);
+pid_t process_spawn (char *cmd_line, const int *fds, size_t fd_cnt);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (struct thread *next);
@@ -14,6 +15,7 @@ void process_activate (struct thread *next);
 struct thread *find_child (tid_t tid);
 bool install_page (void *upage, void *kpage, bool writable);
 bool lazy_load_segment (struct page *page, void *aux);
+bool lazy_zero_segment (struct page *page, void *aux);
 /* END */
 
 struct temp {
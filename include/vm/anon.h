@@ -11,6 +11,9 @@ struct anon_page {
     bool writable;
     off_t offset;
     disk_sector_t swap_loc;
+    struct file *file;     /* Executable holding a read-only page, which
+                              is dropped on eviction and read back from
+                              there instead of going through swap */
 };
 
 void vm_anon_init (void);
@@ -18,5 +21,9 @@ bool anon_initializer (struct page *page, enum vm_type type, void *kva);
 
 /* Our Implementation */
 void _anon_destroy (struct page *page);
+void anon_swap_share (struct page *page, struct page *src);
+void swap_print_stats (void);
+
+extern size_t swap_ra_window;
 
 #endif
@@ -14,13 +14,6 @@ struct file_page {
 };
 
 
-struct mmap_va {
-    uint8_t *start_va;			
-	struct list page_list;	
-    struct list_elem mmaplist_elem;
-};
-
-
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable,
@@ -0,0 +1,42 @@
+#ifndef VM_POLICY_H
+#define VM_POLICY_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct frame;
+
+/* A page replacement policy. The frame table tells the policy when a
+ * frame starts and stops holding pages, and asks it for a victim when
+ * a frame is needed. Every callback is made with vm_lock held. */
+struct vm_policy {
+	const char *name;
+	void (*init) (size_t frame_cnt);
+	void (*frame_used) (struct frame *);	/* Got its first page */
+	void (*frame_freed) (struct frame *);	/* Lost its last page */
+	/* Optional: the page in the frame is not expected to be used again
+	 * soon, as behind a MADV_SEQUENTIAL reader, and should go first. */
+	void (*frame_deactivate) (struct frame *);
+	/* Return an evictable frame, ready to be evicted as a 4KB page,
+	 * or NULL if there is none. */
+	struct frame *(*get_victim) (void);
+	/* Optional: the address space PML4 is going away. Drop what is
+	 * remembered about its evicted pages, which a new address space
+	 * given the same page table would otherwise inherit. */
+	void (*forget) (uint64_t *pml4);
+};
+
+/* Policy in use. Chosen by -vm-policy=NAME, CLOCK by default. */
+extern const struct vm_policy *vm_policy;
+bool vm_policy_select (const char *name);
+
+/* Frame table services for the policies, in vm.c. All of them must be
+ * called with vm_lock held. */
+size_t vm_frame_index (struct frame *frame);
+struct frame *vm_frame_at (size_t idx);
+bool vm_frame_evictable (struct frame *frame);
+bool vm_frame_accessed (struct frame *frame);
+bool vm_frame_prepare_evict (struct frame *frame);
+void vm_frame_owner (struct frame *frame, uint64_t **pml4, void **va);
+
+#endif /* vm/policy.h */
@@ -0,0 +1,20 @@
+#ifndef VM_TRACE_H
+#define VM_TRACE_H
+#include "vm/vm.h"
+#include "devices/disk.h"
+
+struct file;
+struct vma;
+
+/* Exec-time prefetch. The pages a program faults in during the first
+ * TRACE_WINDOW_MS of its first run are recorded, keyed by the inode and
+ * write version of its executable. Later runs of the same executable
+ * have the prefetch thread load them as soon as they are loaded. */
+void vm_trace_init (void);
+void vm_trace_start (struct supplemental_page_table *spt, struct file *file);
+void vm_trace_fault (struct supplemental_page_table *spt, struct vma *vma,
+		void *va);
+void vm_trace_finish (struct supplemental_page_table *spt);
+void vm_trace_forget (disk_sector_t sector);
+
+#endif /* vm/trace.h */
@@ -5,6 +5,7 @@
 #include "lib/kernel/hash.h"
 /* END */
 #include "threads/palloc.h"
+#include "threads/synch.h"
 typedef int tid_t;
 
 enum vm_type {
@@ -38,6 +39,7 @@ enum vm_type {
 struct page_operations;
 struct thread;
 struct frame;
+struct vma;
 
 #define VM_TYPE(type) ((type) & 7)
 
@@ -58,9 +60,17 @@ struct page {
 	bool is_loaded;
 	enum vm_type type;
 	struct hash_elem elem;
-	struct list_elem mmap_elem;
 
 	bool is_swapped;
+	bool writable;         /* Whether the process may write the page */
+	uint64_t *pml4;        /* Page table the page is mapped in, while it
+	                          has a frame or, with FRAME NULL, while it
+	                          is mapped to the shared zero page */
+	struct list_elem rmap_elem;	/* Element in frame->rmap */
+	bool prefaulted;       /* Mapped by fault-around and not seen
+	                          accessed yet */
+	bool busy;             /* Being loaded, evicted, copied or freed;
+	                          see vm_page_acquire() */
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
 	union {
@@ -73,12 +83,30 @@ struct page {
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".
+ * One entry per page of the user pool, kept in an array indexed by
+ * frame number (see vm_frame_of()). After fork() a frame may be shared
+ * copy-on-write by several pages, one per process; all of them are kept
+ * on RMAP. */
 struct frame {
 	void *kva;
-	struct page *page;
-	tid_t tid;
-	struct list_elem elem;
+	struct page *page;     /* One of the pages held in this frame, NULL if
+	                          free. */
+	struct list rmap;      /* Every page mapping this frame. */
+	size_t ref_cnt;        /* Number of pages on RMAP. */
+	bool pinned;           /* Never chosen for eviction while set. */
+	int pin_cnt;           /* System calls copying to or from it; never
+	                          chosen for eviction while nonzero. */
+	struct frame *huge;    /* First frame of the backing 2 MB huge page,
+	                          NULL if the frame is mapped on its own. */
+	bool text;             /* Holds a read-only executable page, found
+	                          in the text cache under TEXT_KEY. */
+	struct text_key {
+		disk_sector_t inode;   /* Inode sector of the executable */
+		off_t ofs;             /* Offset of the page in the file */
+		size_t bytes;          /* Bytes read from the file */
+	} text_key;
+	struct hash_elem text_elem;
 };
 
 /* The function table for page operations.
@@ -102,6 +130,11 @@ struct page_operations {
  * All designs up to you for this. */
 struct supplemental_page_table {
 	struct hash hash_table; 
+	struct vma *vma_root;  /* Areas of the address space, see vma.h */
+	struct vma *stack;     /* Area of the stack, grown down on demand */
+	struct lock lock;      /* Serializes faults, fork() copies and
+	                          teardown of this address space */
+	struct vm_trace *trace;	/* Faults being recorded, see trace.h */
 };
 
 uint64_t spt_hash (const struct hash_elem *he, void *aux);
@@ -115,6 +148,8 @@ bool supplemental_page_table_copy (struct supplemental_page_table *dst,
 void supplemental_page_table_kill (struct supplemental_page_table *spt);
 struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
+struct page *spt_get_page (struct supplemental_page_table *spt, void *va);
+bool vm_install_page (struct page *page, void *kva, bool writable);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
@@ -132,5 +167,23 @@ enum vm_type page_get_type (struct page *page);
 
 /* Our implementation */
 void vm_stack_growth (void *addr UNUSED);
+int do_madvise (void *addr, size_t length, int advice);
+void vm_prefetch_request (struct supplemental_page_table *spt,
+		uint64_t *pml4, void *start, void *end);
+bool vm_pin_buffer (const void *buffer, size_t size, bool write);
+void vm_unpin_buffer (const void *buffer, size_t size);
+
+/* Pages following a faulting ELF or file mapped page that the fault
+ * also populates, if their data is in the buffer cache. Set by
+ * -fault-around=N, which also turns it on for mmap() regions. */
+extern size_t fault_around_pages;
+extern bool fault_around_mmap;
+void vm_print_stats (void);
+
+/* kswapd reclaims in the background once fewer than vm_wmark_low user
+ * frames are free, until vm_wmark_high are. Set by -wm-low=PAGES and
+ * -wm-high=PAGES; a low watermark of 0 turns kswapd off. */
+extern size_t vm_wmark_low;
+extern size_t vm_wmark_high;
 
 #endif  /* VM_VM_H */
@@ -0,0 +1,50 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "vm/vm.h"
+
+/* Access pattern hints of madvise(), as in lib/user/syscall.h. */
+#define MADV_NORMAL     0      /* No hint */
+#define MADV_RANDOM     1      /* No fault-around */
+#define MADV_SEQUENTIAL 2      /* Read ahead, evict behind */
+#define MADV_WILLNEED   3      /* Prefetch in the background */
+#define MADV_DONTNEED   4      /* Drop anonymous pages now */
+
+/* A virtual memory area: a page aligned range of an address space with
+ * the same backing and protection. struct page objects are only created
+ * for it when one of its pages is first faulted in. */
+struct vma {
+	uint8_t *start;        /* First page */
+	uint8_t *end;          /* One past the last page */
+	enum vm_type type;     /* VM_ANON or VM_FILE, and VM_MARKER_0 for
+	                          the stack */
+	bool writable;
+	struct file *file;     /* Backing file, or NULL if zero-filled */
+	off_t offset;          /* Offset in FILE of START */
+	size_t read_bytes;     /* Bytes of FILE from START; the rest of the
+	                          area is zero-filled */
+	int advice;            /* MADV_NORMAL, _RANDOM or _SEQUENTIAL */
+	uint8_t *huge_skip;    /* 2MB region found unfit for a huge page */
+
+	/* AVL tree of the address space, keyed by START */
+	struct vma *left, *right;
+	int height;
+};
+
+struct vma *vma_create (struct supplemental_page_table *spt, void *start,
+		void *end, enum vm_type type, bool writable, struct file *file,
+		off_t offset, size_t read_bytes);
+struct vma *vma_find (struct supplemental_page_table *spt, const void *va);
+bool vma_overlaps (struct supplemental_page_table *spt, const void *start,
+		const void *end);
+bool vma_grow_down (struct supplemental_page_table *spt, struct vma *vma,
+		void *start);
+void vma_remove (struct supplemental_page_table *spt, struct vma *vma);
+bool vma_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src, struct file *prog_file);
+void vma_destroy (struct supplemental_page_table *spt);
+
+#endif /* vm/vma.h */
@@ -0,0 +1,23 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Compressed in-memory tier in front of the swap disk. A page
+ * being swapped out is kept here, compressed, under the swap slot
+ * it was given; it only reaches the disk, at that slot, when the
+ * pool fills up and it is the least recently stored page. */
+
+/* Largest size of the pool, in percent of the user memory it
+ * backs. Set by -zswap=PCT; 0 turns zswap off. */
+extern size_t zswap_max_pool_percent;
+
+void zswap_init (struct disk *swap_disk, size_t slot_cnt);
+bool zswap_store (disk_sector_t slot, const void *kva);
+bool zswap_load (disk_sector_t slot, void *kva);
+bool zswap_contains (disk_sector_t slot);
+void zswap_invalidate (disk_sector_t slot);
+void zswap_print_stats (void);
+
+#endif /* vm/zswap.h */
@@ -27,6 +27,7 @@ typedef unsigned long elem_type;
 struct bitmap {
 	size_t bit_cnt;     /* Number of bits. */
 	elem_type *bits;    /* Elements that represent bits. */
+	size_t hint;        /* Where the next next-fit scan starts. */
 };
 
 /* Returns the index of the element that contains the bit
@@ -63,6 +64,65 @@ last_mask (const struct bitmap *b) {
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns the index of the first bit at or after START in B that
+   is set to VALUE, or B's bit count if there is none.  Whole
+   elements without such a bit are skipped in one step. */
+static size_t
+find_next (const struct bitmap *b, size_t start, bool value) {
+	size_t idx, cnt = elem_cnt (b->bit_cnt);
+	elem_type flip = value ? 0 : (elem_type) -1;
+	elem_type e;
+
+	if (start >= b->bit_cnt)
+		return b->bit_cnt;
+
+	/* Ignore the bits below START in its element. */
+	idx = elem_idx (start);
+	e = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+	while (e == 0) {
+		if (++idx >= cnt)
+			return b->bit_cnt;
+		e = b->bits[idx] ^ flip;
+	}
+
+	start = idx * ELEM_BITS + __builtin_ctzl (e);
+	return start < b->bit_cnt ? start : b->bit_cnt;
+}
+
+/* Returns the mask of the bits in the element holding bit START
+   that fall within [START, END), where END lies in the same
+   element or is its first bit past the end. */
+static inline elem_type
+range_mask (size_t start, size_t end) {
+	elem_type high = end % ELEM_BITS ? bit_mask (end) - 1 : (elem_type) -1;
+	return high & ~(bit_mask (start) - 1);
+}
+
+/* Finds the first group of CNT consecutive bits in B set to
+   VALUE whose first bit lies in [START, LAST].  Returns the
+   index of the group's first bit or BITMAP_ERROR.  Jumps from one
+   run of VALUE bits to the next instead of testing every
+   candidate position. */
+static size_t
+scan_range (const struct bitmap *b, size_t start, size_t last, size_t cnt,
+		bool value) {
+	if (cnt == 0)
+		return start <= last ? start : BITMAP_ERROR;
+
+	while (start <= last) {
+		size_t stop;
+
+		start = find_next (b, start, value);
+		if (start > last)
+			break;
+		stop = find_next (b, start, !value);
+		if (stop - start >= cnt)
+			return start;
+		start = stop;
+	}
+	return BITMAP_ERROR;
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -74,6 +134,7 @@ bitmap_create (size_t bit_cnt) {
 	struct bitmap *b = malloc (sizeof *b);
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
+		b->hint = 0;
 		b->bits = malloc (byte_cnt (bit_cnt));
 		if (b->bits != NULL || bit_cnt == 0) {
 			bitmap_set_all (b, false);
@@ -94,6 +155,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
 	ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
 	b->bit_cnt = bit_cnt;
+	b->hint = 0;
 	b->bits = (elem_type *) (b + 1);
 	bitmap_set_all (b, false);
 	return b;
@@ -194,17 +256,30 @@ bitmap_set_all (struct bitmap *b, bool value) {
 	bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.  Each
+   element is updated atomically, a whole element at a time. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	while (start < end) {
+		size_t chunk_end = (elem_idx (start) + 1) * ELEM_BITS;
+		elem_type *e = &b->bits[elem_idx (start)];
+		elem_type mask;
+
+		if (chunk_end > end)
+			chunk_end = end;
+		mask = range_mask (start, chunk_end);
+		if (value)
+			asm ("lock orq %1, %0" : "+m" (*e) : "r" (mask) : "cc");
+		else
+			asm ("lock andq %1, %0" : "+m" (*e) : "r" (~mask) : "cc");
+		start = chunk_end;
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -228,16 +303,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
-	return false;
+	return cnt > 0 && find_next (b, start, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -272,13 +342,8 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
-	}
+	if (cnt <= b->bit_cnt)
+		return scan_range (b, start, b->bit_cnt - cnt, cnt, value);
 	return BITMAP_ERROR;
 }
 
@@ -297,6 +362,39 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value) {
 	return idx;
 }
 
+/* Like bitmap_scan(), but starts where the previous next-fit
+   scan of B left off and wraps around to the beginning, so that
+   repeated allocations from a mostly full bitmap do not rescan
+   the full prefix every time. */
+size_t
+bitmap_scan_next_fit (struct bitmap *b, size_t cnt, bool value) {
+	size_t last, hint, idx;
+
+	ASSERT (b != NULL);
+
+	if (cnt > b->bit_cnt)
+		return BITMAP_ERROR;
+	last = b->bit_cnt - cnt;
+	hint = b->hint <= last ? b->hint : 0;
+
+	idx = scan_range (b, hint, last, cnt, value);
+	if (idx == BITMAP_ERROR && hint > 0)
+		idx = scan_range (b, 0, hint - 1, cnt, value);
+	if (idx != BITMAP_ERROR)
+		b->hint = idx + cnt;
+	return idx;
+}
+
+/* Like bitmap_scan_and_flip(), but finds the group with
+   bitmap_scan_next_fit(). */
+size_t
+bitmap_scan_and_flip_next_fit (struct bitmap *b, size_t cnt, bool value) {
+	size_t idx = bitmap_scan_next_fit (b, cnt, value);
+	if (idx != BITMAP_ERROR)
+		bitmap_set_multiple (b, idx, cnt, !value);
+	return idx;
+}
+
 /* File input and output. */
 
 #ifdef FILESYS
@@ -1,16 +1,72 @@
 #include <string.h>
+#include <stdint.h>
 #include <debug.h>
 
+/* Copies of at least this many bytes are handed to the string
+   instructions (rep movsb / rep stosb), which the CPU executes as
+   cache-line sized moves.  Below it their startup cost dominates
+   and the word loops win. */
+#define STRING_REP_MIN 256
+
+/* Word used by the medium-size loops.  may_alias lets it read and
+   write any object type; x86-64 tolerates the unaligned access.
+   SSE registers are off limits here (-mno-sse, and the kernel does
+   not save SSE state), so 8 bytes is the widest store we have. */
+typedef uint64_t __attribute__ ((may_alias)) string_word;
+#define WORD_SIZE sizeof (string_word)
+
+/* Zero-byte detection for the string scanners: has_zero(X) is
+   nonzero iff some byte of X is zero, and its lowest set bit is
+   the high bit of the first (lowest-addressed) zero byte.  Bits
+   above that one may be spurious, so only the lowest is used. */
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+#define has_zero(X) (((X) - ONES) & ~(X) & HIGHS)
+
+/* Index of the byte flagged by the lowest bit of a has_zero()
+   mask. */
+#define first_byte(MASK) (__builtin_ctzll (MASK) / 8)
+
+/* Scanners that do not know the string length only read whole
+   aligned words, which never straddle a page boundary, so they
+   cannot fault past the terminator.  An unaligned word is read
+   only if it ends on the same page it starts on. */
+#define SCAN_PAGE_SIZE 4096
+#define is_aligned(P) (((uintptr_t) (P) & (WORD_SIZE - 1)) == 0)
+#define word_fits_page(P) \
+	(((uintptr_t) (P) & (SCAN_PAGE_SIZE - 1)) <= SCAN_PAGE_SIZE - WORD_SIZE)
+
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
 void *
-memcpy (void *dst_, const void *src_, size_t size) {
+(memcpy) (void *dst_, const void *src_, size_t size) {
 	unsigned char *dst = dst_;
 	const unsigned char *src = src_;
 
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
+	if (size >= STRING_REP_MIN) {
+		asm volatile ("rep movsb"
+				: "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+		return dst_;
+	}
+
+	for (; size >= 4 * WORD_SIZE; size -= 4 * WORD_SIZE) {
+		string_word *d = (string_word *) dst;
+		const string_word *s = (const string_word *) src;
+		d[0] = s[0];
+		d[1] = s[1];
+		d[2] = s[2];
+		d[3] = s[3];
+		dst += 4 * WORD_SIZE;
+		src += 4 * WORD_SIZE;
+	}
+	for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+		*(string_word *) dst = *(const string_word *) src;
+		dst += WORD_SIZE;
+		src += WORD_SIZE;
+	}
 	while (size-- > 0)
 		*dst++ = *src++;
 
@@ -27,17 +83,37 @@ memmove (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	if (dst < src) {
+	if (dst <= src || dst >= src + size) {
+		/* A forward copy never overwrites source bytes it has not
+		   read yet, and rep movsb keeps byte-by-byte semantics
+		   even when the regions overlap. */
+		if (size >= STRING_REP_MIN) {
+			asm volatile ("rep movsb"
+					: "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+			return dst_;
+		}
+		for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+			*(string_word *) dst = *(const string_word *) src;
+			dst += WORD_SIZE;
+			src += WORD_SIZE;
+		}
 		while (size-- > 0)
 			*dst++ = *src++;
 	} else {
+		/* Backward copy, one word at a time from the end.  Each word
+		   is loaded before the overlapping store is made. */
 		dst += size;
 		src += size;
+		for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+			dst -= WORD_SIZE;
+			src -= WORD_SIZE;
+			*(string_word *) dst = *(const string_word *) src;
+		}
 		while (size-- > 0)
 			*--dst = *--src;
 	}
 
-	return dst;
+	return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -52,6 +128,14 @@ memcmp (const void *a_, const void *b_, size_t size) {
 	ASSERT (a != NULL || size == 0);
 	ASSERT (b != NULL || size == 0);
 
+	/* Skip equal words; the byte loop below then locates the
+	   differing byte, which is needed for the sign anyway. */
+	for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+		if (*(const string_word *) a != *(const string_word *) b)
+			break;
+		a += WORD_SIZE;
+		b += WORD_SIZE;
+	}
 	for (; size-- > 0; a++, b++)
 		if (*a != *b)
 			return *a > *b ? +1 : -1;
@@ -71,6 +155,31 @@ strcmp (const char *a_, const char *b_) {
 	ASSERT (a != NULL);
 	ASSERT (b != NULL);
 
+	/* Bring A to a word boundary. */
+	for (; !is_aligned (a); a++, b++)
+		if (*a == '\0' || *a != *b)
+			return *a < *b ? -1 : *a > *b;
+
+	/* Compare a word at a time while the words are equal and
+	   contain no terminator.  B may be misaligned, so any word of
+	   B that would cross into the next page is compared bytewise
+	   instead. */
+	for (;;) {
+		string_word wa = *(const string_word *) a;
+		size_t i;
+
+		if (word_fits_page (b)) {
+			if (wa != *(const string_word *) b || has_zero (wa))
+				break;
+			a += WORD_SIZE;
+			b += WORD_SIZE;
+			continue;
+		}
+		for (i = 0; i < WORD_SIZE; i++, a++, b++)
+			if (*a == '\0' || *a != *b)
+				return *a < *b ? -1 : *a > *b;
+	}
+
 	while (*a != '\0' && *a == *b) {
 		a++;
 		b++;
@@ -103,16 +212,27 @@ memchr (const void *block_, int ch_, size_t size) {
 char *
 strchr (const char *string, int c_) {
 	char c = c_;
+	string_word pattern = (unsigned char) c * ONES;
 
 	ASSERT (string);
 
-	for (;;)
+	for (; !is_aligned (string); string++)
 		if (*string == c)
 			return (char *) string;
 		else if (*string == '\0')
 			return NULL;
-		else
-			string++;
+
+	/* Flag bytes that are either C or the terminator, then look
+	   at the first one to tell which. */
+	for (;; string += WORD_SIZE) {
+		string_word w = *(const string_word *) string;
+		string_word mask = has_zero (w) | has_zero (w ^ pattern);
+
+		if (mask != 0) {
+			string += first_byte (mask);
+			return *string == c ? (char *) string : NULL;
+		}
+	}
 }
 
 /* Returns the length of the initial substring of STRING that
@@ -255,11 +375,31 @@ strtok_r (char *s, const char *delimiters, char **save_ptr) {
 
 /* Sets the SIZE bytes in DST to VALUE. */
 void *
-memset (void *dst_, int value, size_t size) {
+(memset) (void *dst_, int value, size_t size) {
 	unsigned char *dst = dst_;
+	string_word pattern;
 
 	ASSERT (dst != NULL || size == 0);
 
+	if (size >= STRING_REP_MIN) {
+		asm volatile ("rep stosb"
+				: "+D" (dst), "+c" (size) : "a" (value) : "memory");
+		return dst_;
+	}
+
+	pattern = (unsigned char) value * 0x0101010101010101ULL;
+	for (; size >= 4 * WORD_SIZE; size -= 4 * WORD_SIZE) {
+		string_word *d = (string_word *) dst;
+		d[0] = pattern;
+		d[1] = pattern;
+		d[2] = pattern;
+		d[3] = pattern;
+		dst += 4 * WORD_SIZE;
+	}
+	for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+		*(string_word *) dst = pattern;
+		dst += WORD_SIZE;
+	}
 	while (size-- > 0)
 		*dst++ = value;
 
@@ -273,9 +413,15 @@ strlen (const char *string) {
 
 	ASSERT (string);
 
-	for (p = string; *p != '\0'; p++)
-		continue;
-	return p - string;
+	for (p = string; !is_aligned (p); p++)
+		if (*p == '\0')
+			return p - string;
+
+	for (;; p += WORD_SIZE) {
+		string_word mask = has_zero (*(const string_word *) p);
+		if (mask != 0)
+			return p + first_byte (mask) - string;
+	}
 }
 
 /* If STRING is less than MAXLEN characters in length, returns
@@ -0,0 +1,147 @@
+/* Test program for the scanning functions in lib/kernel/bitmap.c.
+
+   Checks bitmap_scan() and the next-fit variants against a
+   bit-by-bit reference on random bitmaps, then times single-bit
+   allocation from a large, nearly full bitmap (the swap table
+   and palloc pool case) with the reference scan, the word
+   scan, and the next-fit word scan.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "threads/test.h"
+#include "devices/timer.h"
+
+/* Bits in the bitmaps we check. */
+#define CHECK_BITS 300
+
+/* Bits in the bitmap we time: one per 4 kB page of a 1 GB swap
+   disk. */
+#define BENCH_BITS (256 * 1024)
+
+/* Timer ticks each benchmark runs for. */
+#define BENCH_TICKS 50
+
+static void verify_scan (void);
+static void bench (const char *, int);
+
+/* The bit-at-a-time bitmap_scan() the library used to have. */
+static size_t
+ref_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
+	if (cnt <= bitmap_size (b)) {
+		size_t last = bitmap_size (b) - cnt;
+		size_t i, j;
+
+		for (i = start; i <= last; i++) {
+			for (j = 0; j < cnt; j++)
+				if (bitmap_test (b, i + j) != value)
+					break;
+			if (j == cnt)
+				return i;
+		}
+	}
+	return BITMAP_ERROR;
+}
+
+/* Test the scanners, then time them. */
+void
+test (void) {
+	random_init (0);
+
+	verify_scan ();
+	printf ("bitmap: verified\n");
+
+	bench ("bit-by-bit", 0);
+	bench ("word scan", 1);
+	bench ("next-fit", 2);
+
+	printf ("bitmap: PASS\n");
+}
+
+/* Compares bitmap_scan() with ref_scan() on bitmaps of random
+   size and density, and checks that next-fit scans return a
+   valid group whenever one exists. */
+static void
+verify_scan (void) {
+	int iter;
+
+	for (iter = 0; iter < 500; iter++) {
+		size_t bit_cnt = random_ulong () % CHECK_BITS;
+		struct bitmap *b = bitmap_create (bit_cnt);
+		int density = random_ulong () % 100;
+		size_t i;
+		int k;
+
+		ASSERT (b != NULL);
+		for (i = 0; i < bit_cnt; i++)
+			bitmap_set (b, i, (int) (random_ulong () % 100) < density);
+
+		for (k = 0; k < 50; k++) {
+			size_t start = random_ulong () % (bit_cnt + 1);
+			size_t cnt = random_ulong () % (bit_cnt + 2);
+			bool value = random_ulong () % 2;
+			size_t idx;
+
+			ASSERT (bitmap_scan (b, start, cnt, value)
+					== ref_scan (b, start, cnt, value));
+
+			idx = bitmap_scan_next_fit (b, cnt, value);
+			if (idx == BITMAP_ERROR) {
+				ASSERT (ref_scan (b, 0, cnt, value) == BITMAP_ERROR);
+			} else {
+				ASSERT (!bitmap_contains (b, idx, cnt, !value));
+			}
+		}
+		bitmap_destroy (b);
+	}
+}
+
+/* Fills a BENCH_BITS bitmap, leaves one free bit in every 1000,
+   then for BENCH_TICKS ticks repeatedly allocates a bit with
+   METHOD (0: ref_scan() from 0, 1: bitmap_scan() from 0,
+   2: next-fit) and frees a random allocated one.  Prints the
+   allocations done per tick. */
+static void
+bench (const char *name, int method) {
+	struct bitmap *b = bitmap_create (BENCH_BITS);
+	size_t allocs = 0;
+	int64_t start;
+	size_t i;
+
+	ASSERT (b != NULL);
+	bitmap_set_all (b, true);
+	for (i = 0; i < BENCH_BITS; i += 1000)
+		bitmap_reset (b, i);
+
+	start = timer_ticks ();
+	while (timer_ticks () == start)
+		continue;
+	start = timer_ticks ();
+	while (timer_elapsed (start) < BENCH_TICKS) {
+		size_t idx, victim;
+
+		if (method == 0)
+			idx = ref_scan (b, 0, 1, false);
+		else if (method == 1)
+			idx = bitmap_scan (b, 0, 1, false);
+		else
+			idx = bitmap_scan_next_fit (b, 1, false);
+		ASSERT (idx != BITMAP_ERROR);
+		bitmap_mark (b, idx);
+
+		do
+			victim = random_ulong () % BENCH_BITS;
+		while (!bitmap_test (b, victim));
+		bitmap_reset (b, victim);
+		allocs++;
+	}
+
+	printf ("%s: %zu allocations/tick\n", name, allocs / BENCH_TICKS);
+	bitmap_destroy (b);
+}
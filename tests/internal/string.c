@@ -0,0 +1,322 @@
+/* Test program for the block and string routines in
+   lib/string.c.
+
+   Checks the size-dispatched copy and fill routines against a
+   plain byte loop at every size and alignment around the word
+   and rep-instruction cutoffs, then times both on a few block
+   sizes and prints the throughput of each.  The word-at-a-time
+   scanners (strlen, strchr, strcmp, memcmp) are checked the same
+   way, and strcmp is timed on a directory-lookup style workload.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/test.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+#include "filesys/directory.h"
+
+/* Largest block we check or time. */
+#define MAX_SIZE 4096
+
+/* Timer ticks each benchmark runs for. */
+#define BENCH_TICKS 50
+
+/* Entries in the directory used by the lookup benchmark. */
+#define DIR_ENTRIES 256
+
+static unsigned char src[MAX_SIZE + 64];
+static unsigned char dst[MAX_SIZE + 64];
+static unsigned char ref[MAX_SIZE + 64];
+
+static void verify_copy (void);
+static void verify_move (void);
+static void verify_set (void);
+static void verify_scan (void);
+static void bench (const char *, size_t);
+static void bench_lookup (void);
+
+/* Reference implementations: the byte loops lib/string.c used to
+   have.  noinline keeps the compiler from swapping them for the
+   routines under test. */
+static void * __attribute__ ((noinline))
+byte_memcpy (void *dst_, const void *src_, size_t size) {
+	unsigned char *d = dst_;
+	const unsigned char *s = src_;
+
+	while (size-- > 0)
+		*d++ = *s++;
+	return dst_;
+}
+
+static void * __attribute__ ((noinline))
+byte_memset (void *dst_, int value, size_t size) {
+	unsigned char *d = dst_;
+
+	while (size-- > 0)
+		*d++ = value;
+	return dst_;
+}
+
+static int __attribute__ ((noinline))
+byte_strcmp (const char *a_, const char *b_) {
+	const unsigned char *a = (const unsigned char *) a_;
+	const unsigned char *b = (const unsigned char *) b_;
+
+	while (*a != '\0' && *a == *b) {
+		a++;
+		b++;
+	}
+	return *a < *b ? -1 : *a > *b;
+}
+
+/* Returns -1, 0, or 1 according to the sign of X. */
+static int
+sign (int x) {
+	return x < 0 ? -1 : x > 0;
+}
+
+/* Test the copy and fill routines, then time them. */
+void
+test (void) {
+	static const size_t sizes[] = { 16, 64, 256, 1024, 4096 };
+	size_t i;
+
+	random_init (0);
+	random_bytes (src, sizeof src);
+
+	verify_copy ();
+	verify_move ();
+	verify_set ();
+	verify_scan ();
+	printf ("string: verified\n");
+
+	for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+		bench ("memcpy", sizes[i]);
+	for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+		bench ("memset", sizes[i]);
+	bench_lookup ();
+
+	printf ("string: PASS\n");
+}
+
+/* Sizes worth checking: everything up to a bit past the rep
+   cutoff, then a stride up to MAX_SIZE. */
+static size_t
+next_size (size_t size) {
+	return size < 300 ? size + 1 : size * 3 / 2;
+}
+
+/* Checks memcpy() for each size and each source/destination
+   misalignment within a word, including that bytes just outside
+   the destination are left alone. */
+static void
+verify_copy (void) {
+	size_t size;
+	int s_ofs, d_ofs;
+
+	for (size = 0; size <= MAX_SIZE; size = next_size (size))
+		for (s_ofs = 0; s_ofs < 8; s_ofs++)
+			for (d_ofs = 0; d_ofs < 8; d_ofs++) {
+				memset (dst, 0xcc, sizeof dst);
+				byte_memset (ref, 0xcc, sizeof ref);
+				ASSERT (memcpy (dst + d_ofs, src + s_ofs, size) == dst + d_ofs);
+				byte_memcpy (ref + d_ofs, src + s_ofs, size);
+				ASSERT (!memcmp (dst, ref, sizeof dst));
+			}
+}
+
+/* Checks memmove() in both directions with overlapping regions. */
+static void
+verify_move (void) {
+	size_t size;
+	int shift;
+
+	for (size = 0; size <= MAX_SIZE - 64; size = next_size (size))
+		for (shift = -17; shift <= 17; shift++) {
+			size_t from = 32, to = 32 + shift;
+			size_t i;
+
+			byte_memcpy (dst, src, sizeof dst);
+			byte_memcpy (ref, src, sizeof ref);
+			ASSERT (memmove (dst + to, dst + from, size) == dst + to);
+			for (i = 0; i < size; i++)
+				ref[to + i] = src[from + i];
+			ASSERT (!memcmp (dst, ref, sizeof dst));
+		}
+}
+
+/* Checks memset() for each size and misalignment. */
+static void
+verify_set (void) {
+	size_t size;
+	int ofs;
+
+	for (size = 0; size <= MAX_SIZE; size = next_size (size))
+		for (ofs = 0; ofs < 8; ofs++) {
+			byte_memcpy (dst, src, sizeof dst);
+			byte_memcpy (ref, src, sizeof ref);
+			ASSERT (memset (dst + ofs, 0xa5, size) == dst + ofs);
+			byte_memset (ref + ofs, 0xa5, size);
+			ASSERT (!memcmp (dst, ref, sizeof dst));
+		}
+}
+
+/* Checks strlen(), strchr(), strcmp() and memcmp() for strings
+   of each length at each alignment, with a difference at each
+   position.  The strings are placed at the very end of a page so
+   that any read past the terminator that strays into the next
+   page is at least exercised. */
+static void
+verify_scan (void) {
+	char *page = palloc_get_page (PAL_ASSERT);
+	char *end = page + PGSIZE;
+	char other[80];
+	int len, ofs, pos;
+
+	for (len = 0; len < 40; len++)
+		for (ofs = 0; ofs < 8; ofs++) {
+			char *s = end - len - 1 - ofs;
+			int i;
+
+			for (i = 0; i < len; i++)
+				s[i] = 'a' + (i * 7 + len) % 26;
+			s[len] = '\0';
+
+			ASSERT (strlen (s) == (size_t) len);
+			ASSERT (strchr (s, '\0') == s + len);
+			ASSERT (strchr (s, '#') == NULL);
+			for (i = 0; i < len; i++) {
+				int first = 0;
+				while (s[first] != s[i])
+					first++;
+				ASSERT (strchr (s, s[i]) == s + first);
+			}
+
+			/* Compare against copies at every relative alignment,
+			   differing (or ending early) at each position. */
+			for (pos = 0; pos <= len; pos++) {
+				int o;
+
+				for (o = 0; o < 8; o++) {
+					char *t = other + o;
+
+					byte_memset (other, 0, sizeof other);
+					byte_memcpy (t, s, len + 1);
+					ASSERT (strcmp (s, t) == 0);
+					ASSERT (memcmp (s, t, len) == 0);
+
+					t[pos] = s[pos] + 1;
+					ASSERT (sign (strcmp (s, t)) == sign (byte_strcmp (s, t)));
+					ASSERT (sign (strcmp (t, s)) == sign (byte_strcmp (t, s)));
+					ASSERT (sign (memcmp (s, t, len + 1))
+							== sign (byte_strcmp (s, t)));
+
+					t[pos] = '\0';
+					ASSERT (sign (strcmp (s, t)) == sign (byte_strcmp (s, t)));
+					ASSERT (sign (strcmp (t, s)) == sign (byte_strcmp (t, s)));
+				}
+			}
+		}
+
+	palloc_free_page (page);
+}
+
+/* Runs WHICH on SIZE-byte blocks for BENCH_TICKS ticks with
+   both the byte loop and the library routine, and prints the
+   KB copied per tick by each. */
+static void
+bench (const char *which, size_t size) {
+	bool is_copy = !strcmp (which, "memcpy");
+	size_t rounds[2];
+	int pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		int64_t start;
+
+		rounds[pass] = 0;
+		start = timer_ticks ();
+		while (timer_ticks () == start)
+			continue;
+		start = timer_ticks ();
+		while (timer_elapsed (start) < BENCH_TICKS) {
+			if (is_copy)
+				(pass ? (memcpy) : byte_memcpy) (dst, src, size);
+			else
+				(pass ? (memset) : byte_memset) (dst, 0, size);
+			rounds[pass]++;
+		}
+	}
+
+	printf ("%s %4zu bytes: byte loop %6zu KB/tick, lib %6zu KB/tick\n",
+			which, size,
+			rounds[0] * size / 1024 / BENCH_TICKS,
+			rounds[1] * size / 1024 / BENCH_TICKS);
+}
+
+/* One slot of the benchmark directory, laid out like the entries
+   filesys/directory.c scans in lookup(). */
+struct bench_entry {
+	uint32_t inode_sector;
+	char name[NAME_MAX + 1];
+	bool in_use;
+};
+
+/* Looks NAME up in the DIR_ENTRIES entries of DIR the way
+   lookup() does, comparing with CMP.  Returns the entry index or
+   -1. */
+static int
+bench_find (const struct bench_entry *dir, const char *name,
+		int (*cmp) (const char *, const char *)) {
+	int i;
+
+	for (i = 0; i < DIR_ENTRIES; i++)
+		if (dir[i].in_use && !cmp (name, dir[i].name))
+			return i;
+	return -1;
+}
+
+/* Fills a directory with names that share a long prefix, the
+   worst case for a byte-at-a-time strcmp, then times looking up
+   every name with the byte loop and with strcmp(). */
+static void
+bench_lookup (void) {
+	static struct bench_entry dir[DIR_ENTRIES];
+	size_t lookups[2];
+	int pass, i;
+
+	for (i = 0; i < DIR_ENTRIES; i++) {
+		dir[i].inode_sector = i;
+		snprintf (dir[i].name, sizeof dir[i].name, "datafile-%05d", i);
+		dir[i].in_use = true;
+	}
+	for (i = 0; i < DIR_ENTRIES; i++) {
+		ASSERT (bench_find (dir, dir[i].name, strcmp) == i);
+		ASSERT (bench_find (dir, dir[i].name, byte_strcmp) == i);
+	}
+
+	for (pass = 0; pass < 2; pass++) {
+		int (*cmp) (const char *, const char *) = pass ? strcmp : byte_strcmp;
+		int64_t start;
+
+		lookups[pass] = 0;
+		start = timer_ticks ();
+		while (timer_ticks () == start)
+			continue;
+		start = timer_ticks ();
+		while (timer_elapsed (start) < BENCH_TICKS) {
+			bench_find (dir, dir[lookups[pass] % DIR_ENTRIES].name, cmp);
+			lookups[pass]++;
+		}
+	}
+
+	printf ("lookup in %d entries: byte loop %zu/tick, lib %zu/tick\n",
+			DIR_ENTRIES, lookups[0] / BENCH_TICKS, lookups[1] / BENCH_TICKS);
+}
@@ -0,0 +1,32 @@
+/* Forks a child that execs child-rox, which forks and execs itself
+   once more, and waits for it.  Every process that ran child-rox is
+   gone by then, so the executable must be writable again: the copy
+   of the executable that fork() gave each child must have been
+   closed by its exec(). */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  const char *child_cmd = "child-rox 2";
+  int handle;
+  pid_t child;
+  char buffer[16];
+
+  msg ("exec \"%s\"", child_cmd);
+  if (!(child = fork ("child-rox")))
+    exec (child_cmd);
+  if (child < 0)
+    fail ("fork() returned %d", child);
+  CHECK (wait (child) == 12, "wait for child");
+
+  CHECK ((handle = open ("child-rox")) > 1, "open \"child-rox\"");
+  CHECK (read (handle, buffer, sizeof buffer) == (int) sizeof buffer,
+         "read \"child-rox\"");
+  seek (handle, 0);
+  CHECK (write (handle, buffer, sizeof buffer) == (int) sizeof buffer,
+         "write \"child-rox\"");
+}
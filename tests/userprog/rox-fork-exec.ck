@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rox-fork-exec) begin
+(rox-fork-exec) exec "child-rox 2"
+(child-rox) begin
+(child-rox) try to write "child-rox"
+(child-rox) exec "child-rox 1"
+(child-rox) begin
+(child-rox) try to write "child-rox"
+(child-rox) try to write "child-rox"
+(child-rox) end
+child-rox: exit(12)
+(child-rox) try to write "child-rox"
+(child-rox) end
+child-rox: exit(12)
+(rox-fork-exec) wait for child
+(rox-fork-exec) open "child-rox"
+(rox-fork-exec) read "child-rox"
+(rox-fork-exec) write "child-rox"
+(rox-fork-exec) end
+rox-fork-exec: exit(0)
+EOF
+pass;
@@ -0,0 +1,21 @@
+/* Tries to spawn a child that inherits file descriptors that are
+   not open: one never opened, and one already closed.
+   The spawn system call must return -1 without running the child. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int fds[3] = { 0, 1, 42 };
+  int handle;
+
+  msg ("spawn() with fd 42: %d", spawn ("child-simple", fds, 3));
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  close (handle);
+  fds[2] = handle;
+  msg ("spawn() with a closed fd: %d", spawn ("child-simple", fds, 3));
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(spawn-bad-fd) begin
+(spawn-bad-fd) spawn() with fd 42: -1
+(spawn-bad-fd) open "sample.txt"
+(spawn-bad-fd) spawn() with a closed fd: -1
+(spawn-bad-fd) end
+spawn-bad-fd: exit(0)
+EOF
+pass;
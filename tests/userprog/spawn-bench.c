@@ -0,0 +1,60 @@
+/* Benchmark of spawn() against fork() followed by exec().
+
+   Starts a trivial child COUNT times, one after the other, with the
+   method given as the first argument, and waits for each.  Before
+   that, the parent dirties BALLAST_SIZE bytes of memory, which fork()
+   has to share copy-on-write and spawn() does not look at.  Compare
+   the "Timer: N ticks" line that the kernel prints at shutdown:
+
+     pintos -- -q run 'spawn-bench fork 50'
+     pintos -- -q run 'spawn-bench spawn 50'
+
+   With "child" as its argument, the program just exits. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+#define BALLAST_SIZE (1024 * 1024)
+
+const char *test_name = "spawn-bench";
+
+static char ballast[BALLAST_SIZE];
+
+int
+main (int argc, char *argv[]) 
+{
+  int count, i;
+  bool use_spawn;
+
+  if (argc >= 2 && !strcmp (argv[1], "child"))
+    return 0;
+  if (argc < 2 || (strcmp (argv[1], "fork") && strcmp (argv[1], "spawn")))
+    fail ("usage: spawn-bench fork|spawn [COUNT]");
+  use_spawn = !strcmp (argv[1], "spawn");
+  count = argc >= 3 ? atoi (argv[2]) : 20;
+
+  memset (ballast, 0xcc, sizeof ballast);
+  msg ("start %d children with %s", count,
+       use_spawn ? "spawn()" : "fork()+exec()");
+  for (i = 0; i < count; i++)
+    {
+      pid_t pid;
+
+      if (use_spawn)
+        pid = spawn ("spawn-bench child", NULL, 0);
+      else if ((pid = fork ("spawn-bench")) == 0)
+        {
+          exec ("spawn-bench child");
+          fail ("exec of child %d failed", i);
+        }
+      if (pid == PID_ERROR)
+        fail ("child %d could not be started", i);
+      if (wait (pid) != 0)
+        fail ("child %d failed", i);
+    }
+  msg ("done");
+  return 0;
+}
@@ -0,0 +1,29 @@
+/* Opens a file and spawns a child that inherits its file descriptor,
+   listed twice, under the same number.  The child reads the file
+   through it and closes it.  The parent's descriptor is a separate
+   one, so the parent can still read the file afterwards. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char child_cmd[128];
+  int fds[2];
+  int handle;
+  pid_t pid;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  snprintf (child_cmd, sizeof child_cmd, "child-close %d", handle);
+  fds[0] = fds[1] = handle;
+  if ((pid = spawn (child_cmd, fds, 2)) == PID_ERROR)
+    fail ("spawn(\"%s\") failed", child_cmd);
+  msg ("wait(spawn()) = %d", wait (pid));
+
+  check_file_handle (handle, "sample.txt", sample, sizeof sample - 1);
+}
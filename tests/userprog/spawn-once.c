@@ -0,0 +1,16 @@
+/* Spawns a single child process with spawn() and waits for it. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  pid_t pid;
+
+  msg ("I'm your father");
+  if ((pid = spawn ("child-simple", NULL, 0)) == PID_ERROR)
+    fail ("spawn(\"child-simple\") failed");
+  msg ("wait(spawn()) = %d", wait (pid));
+}
@@ -0,0 +1,57 @@
+/* Benchmark of fork() latency, from a small or a large parent.
+
+   Forks a child COUNT times, one after the other; each child exits
+   at once and the parent waits for it.  With "large", the parent
+   first dirties PAGE_CNT anonymous pages, which a copying fork()
+   has to copy for every child and a copy-on-write fork() only
+   shares.  With "small", it touches nothing beyond its own code,
+   data and stack.  Compare the "Timer: N ticks" line that the
+   kernel prints at shutdown:
+
+     pintos -- -q run 'cow-fork-bench small 50'
+     pintos -- -q run 'cow-fork-bench large 50'
+
+   PAGE_CNT is kept below 2 MB so that no huge page backs the
+   buffer and every page is mapped on its own. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 384
+
+const char *test_name = "cow-fork-bench";
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+int
+main (int argc, char *argv[])
+{
+	int count, i;
+	bool large;
+
+	if (argc < 2 || (strcmp (argv[1], "small") && strcmp (argv[1], "large")))
+		fail ("usage: cow-fork-bench small|large [COUNT]");
+	large = !strcmp (argv[1], "large");
+	count = argc >= 3 ? atoi (argv[2]) : 20;
+
+	if (large)
+		for (i = 0; i < PAGE_CNT; i++)
+			buf[i * PAGE_SIZE] = i & 0xff;
+	msg ("fork %d children from a %s parent", count,
+			large ? "large" : "small");
+	for (i = 0; i < count; i++) {
+		pid_t child = fork ("child");
+
+		if (child == 0)
+			exit (0);
+		if (child == PID_ERROR)
+			fail ("fork %d failed", i);
+		if (wait (child) != 0)
+			fail ("child %d failed", i);
+	}
+	msg ("done");
+	return 0;
+}
@@ -0,0 +1,44 @@
+/* Checks that a page stays shared across two generations of
+   fork(), and that a write by the grandchild copies only its
+   own view of the page. */
+
+#include <string.h>
+#include <syscall.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/large.inc"
+
+void
+test_main (void)
+{
+	const char *buf = "Lorem ipsum";
+	void *pa_parent;
+	pid_t child;
+
+	CHECK (memcmp (buf, large, strlen (buf)) == 0, "check data consistency");
+	pa_parent = get_phys_addr ((void *) large);
+
+	child = fork ("child");
+	if (child == 0) {
+		pid_t grandchild = fork ("grandchild");
+		if (grandchild == 0) {
+			if (get_phys_addr ((void *) large) != pa_parent)
+				exit (1);
+			large[0] = '@';
+			if (get_phys_addr ((void *) large) == pa_parent)
+				exit (2);
+			exit (0);
+		}
+		if (wait (grandchild) != 0)
+			exit (3);
+		if (get_phys_addr ((void *) large) != pa_parent)
+			exit (4);
+		exit (memcmp (buf, large, strlen (buf)) == 0 ? 0 : 5);
+	}
+	CHECK (wait (child) == 0, "child and grandchild share the page");
+	CHECK (pa_parent == get_phys_addr ((void *) large),
+			"two phys addrs should be the same.");
+	CHECK (memcmp (buf, large, strlen (buf)) == 0, "check data consistency");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cow-fork-chain) begin
+(cow-fork-chain) check data consistency
+(cow-fork-chain) child and grandchild share the page
+(cow-fork-chain) two phys addrs should be the same.
+(cow-fork-chain) check data consistency
+(cow-fork-chain) end
+EOF
+pass;
@@ -0,0 +1,47 @@
+/* Forks many children in a row from a parent with a lot of
+   resident memory.  Each child writes a few pages of the
+   parent's memory and exits; the parent checks that none of
+   those writes are visible to it.  With copy-on-write, a fork
+   costs page table entries, not page copies. */
+
+#include <string.h>
+#include <syscall.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 256
+#define CHILD_CNT 32
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+void
+test_main (void)
+{
+	int i, j;
+
+	for (i = 0; i < PAGE_CNT; i++)
+		buf[i * PAGE_SIZE] = i & 0xff;
+
+	for (i = 0; i < CHILD_CNT; i++) {
+		pid_t child = fork ("child");
+		if (child == 0) {
+			for (j = i; j < PAGE_CNT; j += CHILD_CNT) {
+				if (buf[j * PAGE_SIZE] != (char) (j & 0xff))
+					exit (-1);
+				buf[j * PAGE_SIZE] = ~j & 0xff;
+			}
+			exit (i);
+		}
+		if (wait (child) != i)
+			fail ("child %d failed", i);
+	}
+	msg ("forked %d children", CHILD_CNT);
+
+	for (i = 0; i < PAGE_CNT; i++)
+		if (buf[i * PAGE_SIZE] != (char) (i & 0xff))
+			fail ("page %d changed by a child", i);
+	msg ("parent memory intact");
+}
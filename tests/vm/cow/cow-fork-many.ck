@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cow-fork-many) begin
+(cow-fork-many) forked 32 children
+(cow-fork-many) parent memory intact
+(cow-fork-many) end
+EOF
+pass;
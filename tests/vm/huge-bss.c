@@ -0,0 +1,41 @@
+/* Checks that a big zero-filled BSS region is backed by 2 MB huge
+   pages: the first write to an aligned 2 MB region maps all of it to
+   one aligned, physically contiguous run of zeroed frames. */
+
+#include <string.h>
+#include <syscall.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define HUGE_SIZE (2 * 1024 * 1024)
+
+static char big[2 * HUGE_SIZE];
+
+void
+test_main (void)
+{
+	char *huge = (char *) (((uintptr_t) big + HUGE_SIZE - 1)
+			& ~(HUGE_SIZE - 1));
+	uintptr_t pa;
+	size_t i;
+
+	msg ("write first page of the region");
+	huge[0] = 'h';
+	pa = (uintptr_t) get_phys_addr (huge);
+	CHECK (pa != 0 && (pa & (HUGE_SIZE - 1)) == 0,
+			"check region starts a huge page");
+	for (i = PAGE_SIZE; i < HUGE_SIZE; i += PAGE_SIZE)
+		if ((uintptr_t) get_phys_addr (huge + i) != pa + i)
+			fail ("page at offset %zu is not in the huge page", i);
+	msg ("check region is physically contiguous");
+	for (i = 1; i < HUGE_SIZE; i++)
+		if (huge[i] != 0)
+			fail ("byte at offset %zu is not zero", i);
+	msg ("check region is zeroed");
+	huge[HUGE_SIZE - 1] = 'e';
+	CHECK (huge[0] == 'h' && huge[HUGE_SIZE - 1] == 'e',
+			"check region is writable");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(huge-bss) begin
+(huge-bss) write first page of the region
+(huge-bss) check region starts a huge page
+(huge-bss) check region is physically contiguous
+(huge-bss) check region is zeroed
+(huge-bss) check region is writable
+(huge-bss) end
+EOF
+pass;
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lazy-zero) begin
+(lazy-zero) read pages
+(lazy-zero) check memory content
+(lazy-zero) check memory content
+(lazy-zero) check memory content
+(lazy-zero) check if page is loaded
+(lazy-zero) check if page shares the zero page
+(lazy-zero) check if page shares the zero page
+(lazy-zero) write page [1]
+(lazy-zero) check if page has a frame of its own
+(lazy-zero) check memory content
+(lazy-zero) check memory content
+(lazy-zero) check if page shares the zero page
+(lazy-zero) end
+EOF
+pass;
@@ -0,0 +1,70 @@
+/* Checks that madvise(MADV_DONTNEED) drops anonymous pages, so that
+   they read back as zeros, without touching the pages around them.
+   Pages of the stack keep their contents, and a single page of a
+   2 MB zero-filled region, which may be backed by a huge page, is
+   dropped on its own. */
+
+#include <string.h>
+#include <syscall.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define HUGE_SIZE (2 * 1024 * 1024)
+#define CHUNK_PAGE_COUNT 3
+#define CHUNK_SIZE (CHUNK_PAGE_COUNT * PAGE_SIZE)
+
+static char buf[CHUNK_SIZE] __attribute__((aligned (PAGE_SIZE)));
+static char big[2 * HUGE_SIZE];
+
+static bool
+is_zero (const char *p, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		if (p[i] != 0)
+			return false;
+	return true;
+}
+
+void
+test_main (void)
+{
+	char stk[2 * PAGE_SIZE];
+	char *stk_page, *huge;
+	size_t i;
+
+	msg ("dirty anonymous pages");
+	memset (buf, 'a', sizeof buf);
+	CHECK (madvise (buf + PAGE_SIZE, PAGE_SIZE, MADV_DONTNEED) == 0,
+			"madvise page [1]");
+	CHECK (is_zero (buf + PAGE_SIZE, PAGE_SIZE), "check page [1] is zeroed");
+	CHECK (buf[0] == 'a' && buf[2 * PAGE_SIZE] == 'a',
+			"check pages [0] and [2] are kept");
+	buf[PAGE_SIZE] = 'b';
+	CHECK (buf[PAGE_SIZE] == 'b', "check page [1] is writable again");
+
+	msg ("dirty stack page");
+	stk_page = (char *) (((uintptr_t) stk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+	memset (stk_page, 's', PAGE_SIZE);
+	CHECK (madvise (stk_page, PAGE_SIZE, MADV_DONTNEED) == 0,
+			"madvise stack page");
+	CHECK (stk_page[0] == 's' && stk_page[PAGE_SIZE - 1] == 's',
+			"check stack page is kept");
+
+	msg ("dirty 2 MB region");
+	huge = (char *) (((uintptr_t) big + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1));
+	for (i = 0; i < HUGE_SIZE; i += PAGE_SIZE)
+		huge[i] = 'h';
+	CHECK (madvise (huge + 7 * PAGE_SIZE, PAGE_SIZE, MADV_DONTNEED) == 0,
+			"madvise page [7] of the region");
+	CHECK (is_zero (huge + 7 * PAGE_SIZE, PAGE_SIZE),
+			"check page [7] is zeroed");
+	for (i = 0; i < HUGE_SIZE; i += PAGE_SIZE)
+		if (i != 7 * PAGE_SIZE && huge[i] != 'h')
+			fail ("page at offset %zu lost its contents", i);
+	msg ("check other pages of the region are kept");
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(madv-dontneed) begin
+(madv-dontneed) dirty anonymous pages
+(madv-dontneed) madvise page [1]
+(madv-dontneed) check page [1] is zeroed
+(madv-dontneed) check pages [0] and [2] are kept
+(madv-dontneed) check page [1] is writable again
+(madv-dontneed) dirty stack page
+(madv-dontneed) madvise stack page
+(madv-dontneed) check stack page is kept
+(madv-dontneed) dirty 2 MB region
+(madv-dontneed) madvise page [7] of the region
+(madv-dontneed) check page [7] is zeroed
+(madv-dontneed) check other pages of the region are kept
+(madv-dontneed) end
+EOF
+pass;
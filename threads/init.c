@@ -21,6 +21,7 @@
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "threads/vmalloc.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -31,6 +32,8 @@
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/zswap.h"
+#include "vm/policy.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
@@ -86,6 +89,7 @@ main (void) {
 	mem_end = palloc_init ();
 	malloc_init ();
 	paging_init (mem_end);
+	vmalloc_init ();
 
 #ifdef USERPROG
 	tss_init ();
@@ -154,7 +158,7 @@ paging_init (uint64_t mem_end) {
 	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
 		uint64_t va = (uint64_t) ptov(pa);
 
-		perm = PTE_P | PTE_W;
+		perm = PTE_P | PTE_W | PTE_G;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
 
@@ -164,6 +168,7 @@ paging_init (uint64_t mem_end) {
 
 	// reload cr3
 	pml4_activate(0);
+	pml4_init_pcid ();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -225,6 +230,24 @@ parse_options (char **argv) {
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-swap-ra"))
+			swap_ra_window = atoi (value);
+		else if (!strcmp (name, "-zswap"))
+			zswap_max_pool_percent = atoi (value);
+		else if (!strcmp (name, "-fault-around")) {
+			fault_around_pages = atoi (value);
+			fault_around_mmap = true;
+		}
+		else if (!strcmp (name, "-wm-low"))
+			vm_wmark_low = atoi (value);
+		else if (!strcmp (name, "-wm-high"))
+			vm_wmark_high = atoi (value);
+		else if (!strcmp (name, "-vm-policy")) {
+			if (!vm_policy_select (value))
+				PANIC ("unknown page replacement policy `%s'", value);
+		}
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -327,6 +350,14 @@ usage (void) {
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -swap-ra=PAGES     Read PAGES swap slots ahead on swap-in (0: off).\n"
+			"  -zswap=PCT         Compress swap into up to PCT%% of user memory (0: off).\n"
+			"  -fault-around=N    Map up to N cached file pages past a fault (0: off).\n"
+			"  -wm-low=PAGES      Wake kswapd below PAGES free user frames (0: off).\n"
+			"  -wm-high=PAGES     Let kswapd reclaim until PAGES frames are free.\n"
+			"  -vm-policy=NAME    Replace pages by clock, 2q or clock-pro.\n"
 #endif
 			);
 	power_off ();
@@ -355,6 +386,10 @@ print_stats (void) {
 	thread_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
+#endif
+#ifdef VM
+	vm_print_stats ();
+	swap_print_stats ();
 #endif
 	console_print_stats ();
 	kbd_print_stats ();
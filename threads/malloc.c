@@ -8,6 +8,7 @@
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "threads/vmalloc.h"
 
 /* A simple implementation of malloc().
 
@@ -32,7 +33,10 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.  If no
+   physically contiguous run is free, the pages come from
+   vmalloc() instead, which only needs them to be contiguous in
+   kernel virtual memory. */
 
 /* Descriptor. */
 struct desc {
@@ -101,6 +105,8 @@ malloc (size_t size) {
 		   Allocate enough pages to hold SIZE plus an arena. */
 		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
 		a = palloc_get_multiple (0, page_cnt);
+		if (a == NULL)
+			a = vmalloc (page_cnt * PGSIZE, 0);
 		if (a == NULL)
 			return NULL;
 
@@ -233,7 +239,10 @@ free (void *p) {
 			lock_release (&d->lock);
 		} else {
 			/* It's a big block.  Free its pages. */
-			palloc_free_multiple (a, a->free_cnt);
+			if (is_vmalloc_addr (a))
+				vfree (a);
+			else
+				palloc_free_multiple (a, a->free_cnt);
 			return;
 		}
 	}
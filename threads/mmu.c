@@ -2,12 +2,73 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers.  With CR4.PCIDE set, the CPU tags each
+ * TLB entry with the PCID in CR3 when it was made, and a CR3 load with
+ * CR3_NOFLUSH keeps the entries of every PCID, so a process that runs
+ * again finds its translations still cached.  The kernel half of the
+ * address space is mapped global (PTE_G) and survives every switch.
+ *
+ * PCID 0 is for base_pml4.  A user page table gets the ID its physical
+ * page number hashes to, so no search is needed on a context switch.
+ * Two page tables that hash alike take the ID from each other in turn,
+ * and each time the ID changes hands it is flushed once. */
+#define PCID_CNT 4096                   /* 12 bits of CR3. */
+#define CR3_NOFLUSH (1ULL << 63)        /* Keep the TLB entries of the PCID. */
+#define CR4_PGE (1 << 7)                /* Global pages. */
+#define CR4_PCIDE (1 << 17)             /* Process-context identifiers. */
+#define CPUID_PCID (1 << 17)            /* CPUID.01H:ECX. */
+
+struct pcid {
+	uint64_t *pml4;     /* Page table that holds the ID, or NULL. */
+	bool stale;         /* TLB may hold translations PML4 dropped. */
+};
+
+static struct pcid pcids[PCID_CNT];
+static bool pcid_enabled;
+
+static unsigned
+pcid_of (uint64_t *pml4) {
+	return (vtop (pml4) >> PGBITS) % (PCID_CNT - 1) + 1;
+}
+
+/* Turns on global pages, and PCIDs if the CPU has them.  Called once,
+ * with base_pml4 loaded, so that no translation of the loader's page
+ * table is made global.  Toggling CR4.PGE flushes the whole TLB. */
+void
+pml4_init_pcid (void) {
+	uint32_t a, b, c, d;
+
+	ASSERT (PTE_ADDR (rcr3 ()) == vtop (base_pml4));
+	__asm __volatile ("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (1));
+	if (c & CPUID_PCID) {
+		/* CR4.PCIDE may only be set while CR3 holds PCID 0. */
+		lcr3 (vtop (base_pml4));
+		lcr4 (rcr4 () | CR4_PGE | CR4_PCIDE);
+		pcid_enabled = true;
+		/* Whatever PCID 0 holds now goes at the first switch back. */
+		pcids[0].stale = true;
+	} else
+		lcr4 (rcr4 () | CR4_PGE);
+}
+
+/* Drops the TLB entry for VA after a PTE change in PML4.  Only the
+ * running page table can be flushed with invlpg; any other one has its
+ * PCID marked stale, and all of its entries go at its next activation. */
+static void
+pml4_flush (uint64_t *pml4, const void *va) {
+	if (PTE_ADDR (rcr3 ()) == vtop (pml4))
+		invlpg ((uint64_t) va);
+	else if (pcid_enabled && pcids[pcid_of (pml4)].pml4 == pml4)
+		pcids[pcid_of (pml4)].stale = true;
+}
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
@@ -23,6 +84,9 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
+		/* A huge page has no page table; its PDE stands in for the PTE. */
+		if (pdp[idx] & PTE_PS)
+			return &pdp[idx];
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
 	return NULL;
@@ -88,6 +152,26 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the page-directory entry that covers VA in PML4.  If the
+ * page-directory-pointer table or the page directory for VA is missing,
+ * behavior depends on CREATE, as in pml4e_walk(). */
+static uint64_t *
+pde_walk (uint64_t *pml4, const uint64_t va, int create) {
+	uint64_t *table = pml4;
+	int idx[2] = { PML4 (va), PDPE (va) };
+
+	for (int level = 0; level < 2; level++) {
+		if (!(table[idx[level]] & PTE_P)) {
+			uint64_t *new_page;
+			if (!create || (new_page = palloc_get_page (PAL_ZERO)) == NULL)
+				return NULL;
+			table[idx[level]] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+		}
+		table = ptov (PTE_ADDR (table[idx[level]]));
+	}
+	return &table[PDX (va)];
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,10 +206,18 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+		if (((uint64_t) pte) & PTE_P) {
+			if (((uint64_t) pte) & PTE_PS) {
+				/* A huge page is visited once, through its PDE. */
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) pdp_index << PDPESHIFT) |
+									 ((uint64_t) i << PDXSHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
+		}
 	}
 	return true;
 }
@@ -169,8 +261,13 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			pt_destroy (PTE_ADDR (pte));
+		if (((uint64_t) pte) & PTE_P) {
+			if (((uint64_t) pte) & PTE_PS)
+				palloc_free_multiple ((void *) (PTE_ADDR (pte) & ~HPGMASK),
+						HPG_PAGE_CNT);
+			else
+				pt_destroy (PTE_ADDR (pte));
+		}
 	}
 	palloc_free_page ((void *) pdp);
 }
@@ -192,6 +289,10 @@ pml4_destroy (uint64_t *pml4) {
 		return;
 	ASSERT (pml4 != base_pml4);
 
+	/* Give back the PCID; its entries are flushed when it is reused. */
+	if (pcids[pcid_of (pml4)].pml4 == pml4)
+		pcids[pcid_of (pml4)].pml4 = NULL;
+
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
@@ -200,10 +301,46 @@ pml4_destroy (uint64_t *pml4) {
 }
 
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  With PCIDs, the TLB entries of PML4 from the last time
+ * it ran are kept unless its PCID went stale meanwhile. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	enum intr_level old_level;
+	struct pcid *p;
+	uint64_t cr3;
+	unsigned id;
+
+	if (!pcid_enabled) {
+		lcr3 (vtop (pml4 ? pml4 : base_pml4));
+		return;
+	}
+
+	old_level = intr_disable ();
+	if (pml4 == NULL) {
+		/* base_pml4 only maps the kernel, so once flushed, PCID 0 holds
+		 * nothing else. */
+		p = &pcids[0];
+		cr3 = vtop (base_pml4);
+		if (!p->stale)
+			cr3 |= CR3_NOFLUSH;
+		p->stale = false;
+		lcr3 (cr3);
+		intr_set_level (old_level);
+		return;
+	}
+	id = pcid_of (pml4);
+	p = &pcids[id];
+	if (p->pml4 != pml4) {
+		/* Take the ID over; what its last owner left is stale. */
+		p->pml4 = pml4;
+		p->stale = true;
+	}
+	cr3 = vtop (pml4) | id;
+	if (!p->stale)
+		cr3 |= CR3_NOFLUSH;
+	p->stale = false;
+	lcr3 (cr3);
+	intr_set_level (old_level);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -215,8 +352,12 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	ASSERT (is_user_vaddr (uaddr));
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
-	if (pte && (*pte & PTE_P))
+	if (pte && (*pte & PTE_P)) {
+		if (*pte & PTE_PS)
+			return ptov (PTE_ADDR (*pte) & ~HPGMASK)
+				+ ((uint64_t) uaddr & HPGMASK);
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	}
 	return NULL;
 }
 
@@ -236,15 +377,87 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 	ASSERT (pml4 != base_pml4);
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
+	/* Never overwrite a huge page's PDE with a 4 kB mapping. */
+	if (pte && (*pte & PTE_PS))
+		return false;
 	if (pte)
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
 	return pte != NULL;
 }
 
+/* Maps the 2 MB region at user virtual address UPAGE to the huge
+ * physical page at kernel virtual address KPAGE with a single
+ * page-directory entry.  Both addresses must be 2 MB aligned.  If the
+ * region is covered by a page table that still has present entries,
+ * the region is in use and this fails; an empty page table left
+ * behind by earlier mappings is freed and replaced.
+ * Returns true if successful, false otherwise. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT (((uint64_t) upage & HPGMASK) == 0);
+	ASSERT ((vtop (kpage) & HPGMASK) == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+	uint64_t *pde = pde_walk (pml4, (uint64_t) upage, 1);
+
+	if (pde == NULL)
+		return false;
+	if (*pde & PTE_P) {
+		uint64_t *pt;
+
+		if (*pde & PTE_PS)
+			return false;
+		pt = ptov (PTE_ADDR (*pde));
+		for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+			if (pt[i] & PTE_P)
+				return false;
+		palloc_free_page (pt);
+	}
+	*pde = vtop (kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	pml4_flush (pml4, upage);
+	return true;
+}
+
+/* Returns true if user virtual address UPAGE is mapped by a huge page
+ * in PML4. */
+bool
+pml4_is_huge (uint64_t *pml4, const void *upage) {
+	uint64_t *pde = pde_walk (pml4, (uint64_t) upage, 0);
+	return pde != NULL && (*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS);
+}
+
+/* Replaces the huge page that maps UPAGE in PML4 by a page table of
+ * 512 normal PTEs covering the same physical memory, with the same
+ * permission, accessed and dirty bits.  Afterwards each 4 kB page of
+ * the region can be unmapped or evicted on its own.
+ * Returns false if UPAGE is not in a huge page or if memory
+ * allocation fails. */
+bool
+pml4_split_huge_page (uint64_t *pml4, void *upage) {
+	uint64_t *pde = pde_walk (pml4, (uint64_t) upage, 0);
+	uint64_t *pt, pa, flags;
+
+	if (pde == NULL || (*pde & (PTE_P | PTE_PS)) != (PTE_P | PTE_PS))
+		return false;
+	pt = palloc_get_page (PAL_ZERO);
+	if (pt == NULL)
+		return false;
+
+	pa = PTE_ADDR (*pde) & ~HPGMASK;
+	flags = *pde & (PTE_W | PTE_U | PTE_A | PTE_D);
+	for (unsigned i = 0; i < HPG_PAGE_CNT; i++)
+		pt[i] = (pa + i * PGSIZE) | flags | PTE_P;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+
+	pml4_flush (pml4, hpg_round_down (upage));
+	return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
- * UPAGE need not be mapped. */
+ * UPAGE need not be mapped.  If UPAGE lies in a huge page, the
+ * whole 2 MB region is unmapped; split it first to unmap only UPAGE. */
 void
 pml4_clear_page (uint64_t *pml4, void *upage) {
 	uint64_t *pte;
@@ -255,8 +468,7 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		pml4_flush (pml4, upage);
 	}
 }
 
@@ -281,8 +493,7 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		else
 			*pte &= ~(uint32_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		pml4_flush (pml4, vpage);
 	}
 }
 
@@ -307,7 +518,23 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		pml4_flush (pml4, vpage);
+	}
+}
+
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PML4.  Used to write-protect pages shared
+   copy-on-write and to give them back write access once they are
+   no longer shared. */
+void
+pml4_set_writable (uint64_t *pml4, const void *vpage, bool writable) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	if (pte) {
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint64_t) PTE_W;
+
+		pml4_flush (pml4, vpage);
 	}
 }
@@ -8,7 +8,9 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -31,6 +33,7 @@ struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	size_t free_cnt;                /* Number of free pages. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -42,6 +45,7 @@ static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void adjust_free_cnt (struct pool *, size_t page_cnt, bool freed);
 
 /* multiboot info */
 struct multiboot_info {
@@ -250,6 +254,10 @@ palloc_init (void) {
 	printf ("\text_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
 		  ext_mem.start, ext_mem.end, ext_mem.size / 1024);
 	populate_pools (&base_mem, &ext_mem);
+	kernel_pool.free_cnt = bitmap_count (kernel_pool.used_map, 0,
+			bitmap_size (kernel_pool.used_map), false);
+	user_pool.free_cnt = bitmap_count (user_pool.used_map, 0,
+			bitmap_size (user_pool.used_map), false);
 	return ext_mem.end;
 }
 
@@ -268,9 +276,10 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	lock_release (&pool->lock);
 	void *pages;
 
-	if (page_idx != BITMAP_ERROR)
+	if (page_idx != BITMAP_ERROR) {
 		pages = pool->base + PGSIZE * page_idx;
-	else
+		adjust_free_cnt (pool, page_cnt, false);
+	} else
 		pages = NULL;
 
 	if (pages) {
@@ -296,6 +305,54 @@ palloc_get_page (enum palloc_flags flags) {
 	return palloc_get_multiple (flags, 1);
 }
 
+/* Obtains a huge page: HPG_PAGE_CNT contiguous free pages whose
+   first page is aligned to HPGSIZE, so that they can be mapped by a
+   single page-directory entry.  FLAGS are interpreted as in
+   palloc_get_multiple(), except that failure is expected under
+   fragmentation and so PAL_ASSERT is not honored.  Returns a null
+   pointer if no suitably aligned run of free pages exists.
+   The pages may be freed together with palloc_free_multiple() or
+   one by one with palloc_free_page(). */
+void *
+palloc_get_huge_page (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t page_cnt = bitmap_size (pool->used_map);
+	size_t page_idx = (HPGSIZE - ((uint64_t) pool->base & HPGMASK))
+		% HPGSIZE / PGSIZE;
+	void *pages = NULL;
+
+	lock_acquire (&pool->lock);
+	for (; page_idx + HPG_PAGE_CNT <= page_cnt; page_idx += HPG_PAGE_CNT)
+		if (bitmap_none (pool->used_map, page_idx, HPG_PAGE_CNT)) {
+			bitmap_set_multiple (pool->used_map, page_idx, HPG_PAGE_CNT, true);
+			pages = pool->base + PGSIZE * page_idx;
+			break;
+		}
+	lock_release (&pool->lock);
+
+	if (pages != NULL)
+		adjust_free_cnt (pool, HPG_PAGE_CNT, false);
+	if (pages != NULL && (flags & PAL_ZERO))
+		memset (pages, 0, HPGSIZE);
+	return pages;
+}
+
+/* Returns the address of the first page of the user pool and
+   stores the number of pages the pool spans in *PAGE_CNT, so
+   that per-frame data can be kept in an array indexed by page. */
+void *
+palloc_user_pool (size_t *page_cnt) {
+	*page_cnt = bitmap_size (user_pool.used_map);
+	return user_pool.base;
+}
+
+/* Returns the number of free pages in the user pool.  The count
+   may be stale by the time the caller looks at it. */
+size_t
+palloc_user_free_cnt (void) {
+	return user_pool.free_cnt;
+}
+
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) {
@@ -320,6 +377,7 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	adjust_free_cnt (pool, page_cnt, true);
 }
 
 /* Frees the page at PAGE. */
@@ -347,6 +405,21 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
 	*bm_base += bm_pages;
 }
 
+/* Adds PAGE_CNT to the free page count of POOL if FREED, or
+   subtracts it otherwise.  Pages are freed without holding the
+   pool lock, possibly with interrupts off, so the count is kept
+   with interrupts off instead. */
+static void
+adjust_free_cnt (struct pool *pool, size_t page_cnt, bool freed) {
+	enum intr_level old_level = intr_disable ();
+
+	if (freed)
+		pool->free_cnt += page_cnt;
+	else
+		pool->free_cnt -= page_cnt;
+	intr_set_level (old_level);
+}
+
 /* Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool
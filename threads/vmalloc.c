@@ -0,0 +1,170 @@
+#include "threads/vmalloc.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* Kernel virtual area allocator.
+
+   palloc_get_multiple() can only hand out physically contiguous
+   runs of pages, which become scarce as the kernel pool
+   fragments.  vmalloc() instead takes pages one at a time from
+   the kernel pool, wherever they happen to be, and maps them at
+   consecutive addresses in a window of kernel virtual memory
+   reserved for this purpose.
+
+   The window shares its PML4 entry with the rest of the kernel
+   mapping.  Every process page table copies that entry from
+   base_pml4, so mappings added here show up in all address
+   spaces at once.
+
+   Memory from vmalloc() is only virtually contiguous.  It must
+   not be handed to vtop() or to anything built on it, such as
+   palloc_free_page() or pml4_set_page(). */
+
+/* An allocated area. */
+struct vm_area {
+	struct list_elem elem;      /* Element in `areas'. */
+	void *addr;                 /* First mapped page. */
+	size_t page_cnt;            /* Number of mapped pages. */
+};
+
+static struct lock vmalloc_lock;    /* Protects everything below. */
+static struct bitmap *va_map;       /* Pages of the window in use. */
+static struct list areas;           /* Live areas. */
+
+static void unmap_pages (void *addr, size_t page_cnt);
+
+/* Sets up the vmalloc window.  Must run after paging_init(). */
+void
+vmalloc_init (void) {
+	lock_init (&vmalloc_lock);
+	list_init (&areas);
+	va_map = bitmap_create (VMALLOC_PAGES);
+	if (va_map == NULL)
+		PANIC ("vmalloc: cannot allocate window bitmap");
+}
+
+/* Allocates SIZE bytes, rounded up to whole pages, of virtually
+   contiguous kernel memory and returns its address.  If PAL_ZERO
+   is set in FLAGS the memory is zeroed.  Returns a null pointer
+   if memory or window space runs out, unless PAL_ASSERT is set,
+   in which case the kernel panics. */
+void *
+vmalloc (size_t size, enum palloc_flags flags) {
+	size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+	struct vm_area *area;
+	size_t idx, i;
+
+	ASSERT (!(flags & PAL_USER));
+
+	if (page_cnt == 0 || va_map == NULL)
+		goto fail;
+	area = malloc (sizeof *area);
+	if (area == NULL)
+		goto fail;
+
+	lock_acquire (&vmalloc_lock);
+
+	/* Leave one unmapped page after each area so that overruns
+	   fault instead of corrupting the neighbour. */
+	idx = bitmap_scan_and_flip_next_fit (va_map, page_cnt + 1, false);
+	if (idx == BITMAP_ERROR) {
+		lock_release (&vmalloc_lock);
+		free (area);
+		goto fail;
+	}
+	area->addr = (uint8_t *) VMALLOC_START + idx * PGSIZE;
+	area->page_cnt = page_cnt;
+
+	for (i = 0; i < page_cnt; i++) {
+		uint8_t *va = (uint8_t *) area->addr + i * PGSIZE;
+		void *kpage = palloc_get_page (flags & PAL_ZERO);
+		uint64_t *pte = NULL;
+
+		if (kpage != NULL)
+			pte = pml4e_walk (base_pml4, (uint64_t) va, 1);
+		if (pte == NULL) {
+			if (kpage != NULL)
+				palloc_free_page (kpage);
+			unmap_pages (area->addr, i);
+			bitmap_set_multiple (va_map, idx, page_cnt + 1, false);
+			lock_release (&vmalloc_lock);
+			free (area);
+			goto fail;
+		}
+		*pte = vtop (kpage) | PTE_P | PTE_W | PTE_G;
+	}
+	list_push_back (&areas, &area->elem);
+
+	lock_release (&vmalloc_lock);
+	return area->addr;
+
+fail:
+	if (flags & PAL_ASSERT)
+		PANIC ("vmalloc: out of memory");
+	return NULL;
+}
+
+/* Frees the area at ADDR, which must have been returned by
+   vmalloc().  Does nothing if ADDR is a null pointer. */
+void
+vfree (void *addr) {
+	struct vm_area *area = NULL;
+	struct list_elem *e;
+
+	if (addr == NULL)
+		return;
+	ASSERT (is_vmalloc_addr (addr));
+
+	lock_acquire (&vmalloc_lock);
+	for (e = list_begin (&areas); e != list_end (&areas); e = list_next (e)) {
+		struct vm_area *a = list_entry (e, struct vm_area, elem);
+		if (a->addr == addr) {
+			area = a;
+			break;
+		}
+	}
+	ASSERT (area != NULL);
+
+	list_remove (&area->elem);
+	unmap_pages (area->addr, area->page_cnt);
+	bitmap_set_multiple (va_map,
+			((uint8_t *) addr - (uint8_t *) VMALLOC_START) / PGSIZE,
+			area->page_cnt + 1, false);
+	lock_release (&vmalloc_lock);
+
+	free (area);
+}
+
+/* Returns true if ADDR lies in the vmalloc window. */
+bool
+is_vmalloc_addr (const void *addr) {
+	return addr >= VMALLOC_START && addr < VMALLOC_END;
+}
+
+/* Unmaps the PAGE_CNT pages starting at ADDR and returns their
+   frames to the kernel pool.  The page tables stay in place for
+   later areas.  The caller must hold vmalloc_lock. */
+static void
+unmap_pages (void *addr, size_t page_cnt) {
+	size_t i;
+
+	for (i = 0; i < page_cnt; i++) {
+		uint64_t va = (uint64_t) addr + i * PGSIZE;
+		uint64_t *pte = pml4e_walk (base_pml4, va, 0);
+
+		ASSERT (pte != NULL && (*pte & PTE_P));
+		palloc_free_page (ptov (PTE_ADDR (*pte)));
+		*pte = 0;
+		invlpg (va);
+	}
+}
@@ -10,6 +10,14 @@
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+/* An instruction of usercopy.S that may fault on a user address, and
+ * where to resume if it does. The linker gathers them in __ex_table. */
+struct exception_entry {
+	uint64_t insn;
+	uint64_t fixup;
+};
+extern const struct exception_entry __start_ex_table[], __stop_ex_table[];
+
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
 
@@ -146,6 +154,14 @@ page_fault (struct intr_frame *f) {
 		return;
 #endif
 
+	/* A bad user address met by copy_from_user() and friends: make the
+	   copy fail instead. */
+	uint64_t fixup = user ? 0 : exception_fixup_of (f->rip);
+	if (fixup != 0) {
+		f->rip = fixup;
+		return;
+	}
+
 	/* Count page faults. */
 	page_fault_cnt++;
 	/* If the fault is true fault, show info and exit. */
@@ -157,3 +173,13 @@ page_fault (struct intr_frame *f) {
 	kill (f);
 }
 
+/* Return where to resume after a fault at kernel instruction RIP, or 0
+   if RIP may not fault. There are only a handful of entries. */
+uint64_t
+exception_fixup_of (uint64_t rip) {
+	for (const struct exception_entry *e = __start_ex_table;
+			e < __stop_ex_table; e++)
+		if (e->insn == rip)
+			return e->fixup;
+	return 0;
+}
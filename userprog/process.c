@@ -21,6 +21,8 @@
 #include "intrinsic.h"
 #include "vm/vm.h"
 #include "vm/file.h"
+#include "vm/vma.h"
+#include "vm/trace.h"
 #define WORD_SIZE 8
 #define LOG 0
 
@@ -175,6 +177,15 @@ __do_fork (void *aux) {
 	process_activate (current);
 #ifdef VM
 	supplemental_page_table_init (&current->spt);
+	/* Lazily loaded pages of the child read the executable through a
+	 * handle of its own, which outlives the parent's. */
+	if (parent->prog_file != NULL) {
+		lock_acquire (&file_access);
+		current->prog_file = file_duplicate (parent->prog_file);
+		lock_release (&file_access);
+		if (current->prog_file == NULL)
+			goto error;
+	}
 	if (!supplemental_page_table_copy (&current->spt, &parent->spt))
 		goto error;
 #else
@@ -230,6 +241,133 @@ error:
 	thread_exit ();
 }
 
+/* Our Implementation */
+/* What spawn() hands to the new process. The child frees it, since the
+ * parent may return before the child is done with it. */
+struct spawn_info {
+	struct thread *parent;
+	char *cmd_line;            /* Page of our own, freed by the child */
+	size_t fd_cnt;
+	int fds[];                 /* Descriptors the child inherits */
+};
+
+/* Give the running thread, a new process, a duplicate of the file
+ * descriptors FDS of PARENT, under the same numbers. The console ones,
+ * 0 and 1, are always there, and a descriptor listed twice is inherited
+ * once. Return false if one of them is not open. */
+static bool
+inherit_fds (struct thread *parent, const int *fds, size_t fd_cnt) {
+	struct thread *current = thread_current ();
+	bool success = true;
+
+	lock_acquire (&file_access);
+	for (size_t i = 0; i < fd_cnt && success; i++) {
+		struct file_info *pfi, *fi;
+		size_t j;
+
+		for (j = 0; j < i && fds[j] != fds[i]; j++)
+			continue;
+		if (fds[i] == 0 || fds[i] == 1 || j < i)
+			continue;
+		pfi = NULL;
+		for (struct list_elem *e = list_begin (&parent->file_list);
+				e != list_end (&parent->file_list); e = list_next (e))
+			if (list_entry (e, struct file_info, file_elem)->fd == fds[i])
+				pfi = list_entry (e, struct file_info, file_elem);
+		fi = pfi != NULL ? malloc (sizeof *fi) : NULL;
+		if (fi == NULL) {
+			success = false;
+			break;
+		}
+		fi->file = file_duplicate (pfi->file);
+		if (fi->file == NULL) {
+			free (fi);
+			success = false;
+			break;
+		}
+		fi->fd = pfi->fd;
+		list_push_back (&current->file_list, &fi->file_elem);
+		if (current->fd <= fi->fd)
+			current->fd = fi->fd + 1;
+	}
+	lock_release (&file_access);
+	return success;
+}
+
+/* A thread function that loads the program of spawn() into a fresh
+ * address space. Nothing of the parent's memory is copied. */
+static void
+__do_spawn (void *aux) {
+	struct spawn_info *info = aux;
+	struct thread *current = thread_current ();
+	struct intr_frame if_;
+	char *cmd_line = info->cmd_line;
+	bool success;
+
+#ifdef VM
+	supplemental_page_table_init (&current->spt);
+#endif
+	process_init ();
+	success = inherit_fds (info->parent, info->fds, info->fd_cnt);
+	free (info);
+
+	if_.ds = if_.es = if_.ss = SEL_UDSEG;
+	if_.cs = SEL_UCSEG;
+	if_.eflags = FLAG_IF | FLAG_MBS;
+	if (success)
+		success = load (cmd_line, &if_);
+	palloc_free_page (cmd_line);
+
+	current->filecopy_success = success;
+	if (!success)
+		current->exit_status = -1;
+	sema_up (&current->filecopy_sema);
+	if (success)
+		do_iret (&if_);
+	thread_exit ();
+}
+
+/* Start the program of CMD_LINE, a page that this function takes over,
+ * in a new child process that inherits the FD_CNT file descriptors FDS
+ * and nothing else. Unlike fork() and exec(), the parent's address
+ * space and descriptor table are not copied first. Return the child's
+ * pid once it is loaded, or PID_ERROR if it could not be. */
+pid_t
+process_spawn (char *cmd_line, const int *fds, size_t fd_cnt) {
+	struct spawn_info *info;
+	char name[16];
+	struct thread *child;
+	tid_t tid;
+
+	info = malloc (sizeof *info + fd_cnt * sizeof *info->fds);
+	if (info == NULL) {
+		palloc_free_page (cmd_line);
+		return PID_ERROR;
+	}
+	info->parent = thread_current ();
+	info->cmd_line = cmd_line;
+	info->fd_cnt = fd_cnt;
+	memcpy (info->fds, fds, fd_cnt * sizeof *info->fds);
+	strlcpy (name, cmd_line, sizeof name);
+	name[strcspn (name, " ")] = '\0';
+
+	tid = thread_create (name, PRI_DEFAULT, __do_spawn, info);
+	if (tid == TID_ERROR) {
+		palloc_free_page (cmd_line);
+		free (info);
+		return PID_ERROR;
+	}
+	/* The child stays on our list until we wait() for it, and we must not
+	 * return before it signals: it still reads our descriptor table. */
+	child = find_child (tid);
+	ASSERT (child != NULL);
+	sema_down (&child->filecopy_sema);
+	if (!child->filecopy_success)
+		return PID_ERROR;
+	return tid;
+}
+/* END */
+
 /* Switch the current execution context to the f_name.
  * Returns -1 on fail. */
 int
@@ -248,27 +386,22 @@ process_exec (void *f_name) {
 	_if.eflags = FLAG_IF | FLAG_MBS;
 	/* We first kill the current context */
 	/* Our Implementation */
-	// char file_copy[256];
-	char *file_copy = (char *)calloc(strlen(file_name)+1, sizeof(char));
-	if (file_copy == NULL)
-	{
-		process_cleanup ();
-		return -1;
-	}
-	strlcpy(file_copy, file_name, strlen(file_name) + 1);
+	// F_NAME is a page of our own, from initd or from exec()
 	process_cleanup ();
+	/* The old executable, duplicated by fork(), is no longer read, and
+	 * denies writes to its file until it is closed. */
+	file_close (thread_current ()->prog_file);
+	thread_current ()->prog_file = NULL;
 	/* And then load the binary */
-	success = load (file_copy, &_if);
-	struct thread *t = thread_current();
+	success = load (file_name, &_if);
+	palloc_free_page (file_name);
 	/* If load failed, quit. */
 	if (!success)
 	{
 		if(LOG)
 			printf("Load failed. Quit\n");
-		free(file_copy);
 		return -1;
 	}
-	free(file_copy);
 	if(LOG)
 		printf("Load successful, start switched process.\n");
 	/* Start switched process. */
@@ -341,18 +474,8 @@ process_exit (void) {
 		free(fi);
 	}
 
-	struct list_elem *e = list_begin(&curr->mmap_list);
-	
-	for (e; e != list_end(&curr->mmap_list);)
-	{
-		struct mmap_va *mmap_va = list_entry (e, struct mmap_va, mmaplist_elem);
-		if (mmap_va != NULL)	
-		{
-			e = list_next(e);
-			do_munmap(mmap_va->start_va);
-		}
-		else e = list_next(e);
-	}
+	/* Mappings are written back and unmapped with the rest of the
+	 * address space, in process_cleanup() */
 
 	// struct list_elem *s = list_begin(&curr->sym_list);
 
@@ -372,8 +495,11 @@ process_exit (void) {
 	curr->fd = 2;
 	// ASSERT(file_deny_cnt(curr->prog_file) != 0);
 	// printf("Close prog_file\n");
-	file_close(curr->prog_file);
+	/* Pages of the executable may still be read back from it, and frames
+	 * of its text are found by its inode, until the page table goes. */
 	process_cleanup ();
+	file_close(curr->prog_file);
+	curr->prog_file = NULL;
 }
 
 /* Free the current process's resources. */
@@ -709,6 +835,9 @@ load (const char *file_name, struct intr_frame *if_) {
 	 * TODO: Implement argument passing (see project2/argument_passing.html). */
 	/* Our Implemantation */
 	success = pass_arguments((char *)file_name, if_);
+	// Prefetch what the last run touched first, or record it
+	if (success)
+		vm_trace_start(&t->spt, file);
 	/* END */
 
 done:
@@ -891,6 +1020,7 @@ lazy_load_segment (struct page *page, void *aux) {
     size_t page_zero_bytes = PGSIZE - page_read_bytes;	// Calculate page_zero_bytes by substituting read bytes from PGSIZE
     bool writable = temp->writable;
     off_t offset = temp->offset;
+	free(temp);	// Created for this fault only, the area keeps the rest
 
 	// Load anon_page from temp
 	if (page->type == VM_ANON)	// When page type is Anonymous Page
@@ -899,6 +1029,9 @@ lazy_load_segment (struct page *page, void *aux) {
 		anon_page->page_read_bytes = page_read_bytes;
 		anon_page->writable = writable;
 		anon_page->offset = offset;
+		// Never written, so eviction can drop it and reread the file
+		if (!writable)
+			anon_page->file = file;
 	}
 
 	if (page->type == VM_FILE)	// When page type is Memory Mapped File
@@ -912,11 +1045,10 @@ lazy_load_segment (struct page *page, void *aux) {
 
 	ASSERT(file != NULL);
 	
-	file_seek(file, offset);	// Start reading from the specific offset of file
-	
+	/* Faults do not hold file_access, so leave the file position alone */
 	int read;
 	
-	if ((read = file_read(file, frame->kva, page_read_bytes)) != (int)page_read_bytes)	// Load file content to memory
+	if ((read = file_read_at(file, frame->kva, page_read_bytes, offset)) != (int)page_read_bytes)	// Load file content to memory
 	{
 		if (page->type == VM_ANON)
 			return false;
@@ -928,10 +1060,19 @@ lazy_load_segment (struct page *page, void *aux) {
 		printf("	Page(0x%lx) loaded successfully\n", page->va);
 	}
 
-	return install_page(page->va, frame->kva, writable);	// Add map from VA to KVA and mark the writable bit
+	return vm_install_page(page, frame->kva, writable);	// Add map from VA to KVA and mark the writable bit
 }
 
 
+/* Initializer of a page of BSS: the frame it was given is zeroed
+ * already, so it only needs mapping. There is no file to read and no
+ * aux. */
+bool
+lazy_zero_segment (struct page *page, void *aux UNUSED) {
+	page->anon.writable = page->writable;
+	return vm_install_page(page, page->frame->kva, page->writable);
+}
+
 /* Loads a segment starting at offset OFS in FILE at address
  * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
  * memory are initialized, as follows:
@@ -953,34 +1094,21 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
-	/* Not sure */
-	while (read_bytes > 0 || zero_bytes > 0) {
-		/* Do calculate how to fill this page.
-		 * We will read PAGE_READ_BYTES bytes from FILE
-		 * and zero the final PAGE_ZERO_BYTES bytes. */
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	size_t file_bytes = ROUND_UP (read_bytes, PGSIZE);
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		struct temp *temp = (struct temp *) malloc(sizeof(struct temp));	// We use temp structure to pass over the information about loading page
-		
-		if (temp == NULL)
-			return false;
-        
-		temp->file = file;
-        temp->page_read_bytes = page_read_bytes;	// We don't need to get page_zero_bytes because it is always PGSIZE - page_read_bytes
-        temp->writable = writable;
-		temp->offset = ofs;
-
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,	// Anonymous page will be loaded later if it is required during the program
-					writable, lazy_load_segment, temp))
-			return false;
-
-		read_bytes -= page_read_bytes;
-		zero_bytes -= page_zero_bytes;
-		upage += PGSIZE;
-		ofs += page_read_bytes;
-	}
+	/* The pages holding bytes of the file are one area, and the pages of
+	 * pure BSS after them another, with no file. Pages are created on
+	 * their first fault, with the information lazy_load_segment needs
+	 * for them, or none at all for BSS. */
+	if (file_bytes > 0 && vma_create (spt, upage, upage + file_bytes,
+				VM_ANON, writable, file, ofs, read_bytes) == NULL)
+		return false;
+	if (read_bytes + zero_bytes > file_bytes
+			&& vma_create (spt, upage + file_bytes,
+				upage + read_bytes + zero_bytes, VM_ANON, writable, NULL, 0,
+				0) == NULL)
+		return false;
 	return true;
 }
 
@@ -997,6 +1125,11 @@ setup_stack (struct intr_frame *if_) {
 	 * TODO: You should mark the page is stack. */
 	/* TODO: Your code goes here */
 	struct thread *t = thread_current();
+	// The stack area starts with this page and grows down from it
+	t->spt.stack = vma_create(&t->spt, stack_bottom, (void *) USER_STACK,
+			VM_ANON | VM_MARKER_0, true, NULL, 0, 0);
+	if (t->spt.stack == NULL)
+		PANIC("setup stack error");
 	success = vm_claim_page(stack_bottom);	// Claim the page which have va as stack_bottom and map with proper frame right away
 	
 	// Mark the page as STACK (VM_MARKER_0)
@@ -1,5 +1,6 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -22,6 +23,9 @@ int chan_dev;
 #include "filesys/filesys.h"
 #include "threads/synch.h"
 #include "vm/file.h"
+#include "vm/vma.h"
+#include "threads/palloc.h"
+#include "userprog/exception.h"
 #include "filesys/inode.h"
 /* END */
 
@@ -100,19 +104,21 @@ void delete_file (int fd) {
 }
 /* End for functions used in file related syscalls */
 
-void assert_valid_useraddr(const void *vaddr, int8_t *rsp) {
-   if (!is_user_vaddr(vaddr))  exit(-1);
-   if (!spt_find_page(&thread_current()->spt, pg_round_down(vaddr))) // If the address and rsp value is in stack grow condition, grow it here because we know the rsp value
+/* Copy the string at user address USTR into a new page and return it,
+ * to be freed with palloc_free_page(). Exit(-1) if USTR is not a valid
+ * string of less than a page. */
+static char *copy_in_string (const char *ustr)
+{
+   char *kstr = palloc_get_page(0);
+   if (kstr == NULL)
+      exit(-1);
+   long len = strncpy_from_user(kstr, ustr, PGSIZE);
+   if (len < 0 || len == PGSIZE)
    {
-       if (vaddr < USER_STACK && vaddr > USER_STACK - (1 << 20))  // Stack size is 1MB
-      {
-         if (rsp == vaddr + 8 || vaddr > rsp)   
-         {
-            vm_stack_growth(pg_round_down(vaddr));
-            return true;
-         }
-      }
+      palloc_free_page(kstr);
+      exit(-1);
    }
+   return kstr;
 }
 
 /* Start of syscall functions used in syscall handler */
@@ -224,6 +230,10 @@ int
 read (int fd, void *buffer, unsigned size)
 {
    not_code_segment(buffer);
+   // Fault the buffer in now, a page fault while holding file_access
+   // would have to wait for the disk with every other file syscall
+   if (!vm_pin_buffer(buffer, size, true))
+      exit(-1);
    lock_acquire(&file_access);
    if (fd == 0) //STDIN
    {
@@ -235,6 +245,7 @@ read (int fd, void *buffer, unsigned size)
          iRead+=1;
       }
       lock_release(&file_access);
+      vm_unpin_buffer(buffer, size);
       return iRead;
    }
    else
@@ -243,27 +254,33 @@ read (int fd, void *buffer, unsigned size)
       if (!file)
       {
          lock_release(&file_access);
+         vm_unpin_buffer(buffer, size);
          return -1;
       }
       // If this is directory, read not allowed.
       if (inode_is_dir(file->inode))
       {
          lock_release(&file_access);
+         vm_unpin_buffer(buffer, size);
          return -1;
       }
       int iRead = file_read(file, buffer, size); // from file.h
       lock_release (&file_access);
+      vm_unpin_buffer(buffer, size);
       return iRead;
    }
 }
 
 int write (int fd, const void *buffer, unsigned size)
 {
+   if (!vm_pin_buffer(buffer, size, false))
+      exit(-1);
    lock_acquire(&file_access);
     if (fd == 1) //STDOUT
     {
       putbuf (buffer, size); // from stdio.h
       lock_release(&file_access);
+      vm_unpin_buffer(buffer, size);
       return size;
     }
 
@@ -271,15 +288,18 @@ int write (int fd, const void *buffer, unsigned size)
     if (!file)
     {
       lock_release(&file_access);
+      vm_unpin_buffer(buffer, size);
       return -1;
     }
     if (inode_is_dir(file->inode))
     {
        lock_release(&file_access);
+       vm_unpin_buffer(buffer, size);
        return -1;
     }
     int iWrite = file_write(file, buffer, size); // file.h
     lock_release (&file_access);
+    vm_unpin_buffer(buffer, size);
     return iWrite;
 }
 
@@ -540,20 +560,24 @@ syscall_handler (struct intr_frame *f) {
    /* Our Implementation */
    // syscall_print(f->R.rax);
    //printf("MUNMAP : %d, syscall %d\n", SYS_MUNMAP, f->R.rax);
+   // User pointers are not checked up front: the copies fail on bad ones,
+   // and page faults on them grow the stack against the user's rsp
+   char *kstr, *kstr2;
+   thread_current()->user_rsp = (void *) f->rsp;
    switch (f->R.rax) {
       case SYS_HALT:
          halt();
          break;
       case SYS_EXIT:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
          exit(f->R.rdi);
          break;
       case SYS_FORK:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
+         kstr = copy_in_string((const char *) f->R.rdi);
          /* For sys_fork() only */
          struct thread_and_if *tif = malloc(sizeof(struct thread_and_if));
          if (tif == NULL) 
          {
+            palloc_free_page(kstr);
             f->R.rax = TID_ERROR;
             break;
          }
@@ -563,115 +587,122 @@ syscall_handler (struct intr_frame *f) {
          {
             free(tif->if_);
             free(tif);
+            palloc_free_page(kstr);
             f->R.rax = TID_ERROR;
             break;
          }
          memcpy(tif->if_, f, sizeof(struct intr_frame));
-         f->R.rax = sys_fork(f->R.rdi, tif);
+         f->R.rax = sys_fork(kstr, tif);
+         palloc_free_page(kstr);
          break;
       case SYS_EXEC:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
-         f->R.rax = exec(f->R.rdi);
+         // process_exec() frees the copy
+         f->R.rax = exec(copy_in_string((const char *) f->R.rdi));
          break;
       case SYS_WAIT:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
          f->R.rax = wait(f->R.rdi);
          break;
+      case SYS_SPAWN:
+      {
+         int fds[SPAWN_MAX_FDS];
+         size_t fd_cnt = f->R.rdx;
+         if (fd_cnt > SPAWN_MAX_FDS)
+         {
+            f->R.rax = PID_ERROR;
+            break;
+         }
+         if (copy_from_user(fds, (const void *) f->R.rsi,
+                            fd_cnt * sizeof *fds) != 0)
+            exit(-1);
+         // process_spawn() frees the copy
+         f->R.rax = process_spawn(copy_in_string((const char *) f->R.rdi),
+                                  fds, fd_cnt);
+         break;
+      }
       case SYS_CREATE:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
-         f->R.rax = create(f->R.rdi, f->R.rsi);
+         kstr = copy_in_string((const char *) f->R.rdi);
+         f->R.rax = create(kstr, f->R.rsi);
+         palloc_free_page(kstr);
          break;
       case SYS_REMOVE:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
-         f->R.rax = remove(f->R.rdi);
+         kstr = copy_in_string((const char *) f->R.rdi);
+         f->R.rax = remove(kstr);
+         palloc_free_page(kstr);
          break;
       case SYS_OPEN:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
-         f->R.rax = open(f->R.rdi);
+         kstr = copy_in_string((const char *) f->R.rdi);
+         f->R.rax = open(kstr);
+         palloc_free_page(kstr);
          break;
       case SYS_FILESIZE:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
          f->R.rax = filesize(f->R.rdi);
          break;
       case SYS_READ:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
-         assert_valid_useraddr(f->R.rsi, f->rsp);
-         assert_valid_useraddr(f->R.rdx, f->rsp);
-         int8_t *startbuf = f->R.rsi;
-         int8_t *endbuf = f->R.rsi + f->R.rdx;
-         while(endbuf >= startbuf)     // To prevent page fault during the file read, grow stack properly not to confront such problem
-         {
-            assert_valid_useraddr(endbuf, f->rsp);
-            endbuf -= PGSIZE;
-         }
-         f->R.rax = read(f->R.rdi, f->R.rsi, f->R.rdx);
+         // read() and write() pin the buffer in place of copying it
+         f->R.rax = read(f->R.rdi, (void *) f->R.rsi, f->R.rdx);
          break;
       case SYS_WRITE:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
-         assert_valid_useraddr(f->R.rsi, f->rsp);
-         assert_valid_useraddr(f->R.rdx, f->rsp);
-         f->R.rax = write(f->R.rdi, f->R.rsi, f->R.rdx);
+         f->R.rax = write(f->R.rdi, (const void *) f->R.rsi, f->R.rdx);
          break;
       case SYS_SEEK:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
-         assert_valid_useraddr(f->R.rsi, f->rsp);
          seek(f->R.rdi, f->R.rsi);
          break;
       case SYS_TELL:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
          f->R.rax = tell(f->R.rdi);
          break;
       case SYS_CLOSE:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
          close(f->R.rdi);
          break;
       case SYS_MMAP:
-         // assert_valid_useraddr(f->R.rdi, f->rsp);
-         // assert_valid_useraddr(f->R.rsi, f->rsp);
-         // assert_valid_useraddr(f->R.rdx, f->rsp);
-         // assert_valid_useraddr(f->R.r10, f->rsp);
-         // assert_valid_useraddr(f->R.r8, f->rsp);
          f->R.rax = call_mmap(f->R.rdi, f->R.rsi, f->R.rdx, f->R.r10, f->R.r8);
          break;
       case SYS_MUNMAP:
-         // assert_valid_useraddr(f->R.rdi, f->rsp);
          do_munmap(f->R.rdi);
          break;
+      case SYS_MADVISE:
+         f->R.rax = do_madvise((void *) f->R.rdi, f->R.rsi, f->R.rdx);
+         break;
       case SYS_CHDIR:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
-         f->R.rax = chdir(f->R.rdi);
+         kstr = copy_in_string((const char *) f->R.rdi);
+         f->R.rax = chdir(kstr);
+         palloc_free_page(kstr);
          break;
       case SYS_MKDIR:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
-         f->R.rax = mkdir(f->R.rdi);
+         kstr = copy_in_string((const char *) f->R.rdi);
+         f->R.rax = mkdir(kstr);
+         palloc_free_page(kstr);
          break;
       case SYS_READDIR:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
-         assert_valid_useraddr(f->R.rsi, f->rsp);
-         f->R.rax = readdir(f->R.rdi, f->R.rsi);
+      {
+         char name[NAME_MAX + 1];
+         f->R.rax = readdir(f->R.rdi, name);
+         if (f->R.rax && copy_to_user((void *) f->R.rsi, name,
+                                      strlen(name) + 1) != 0)
+            exit(-1);
          break;
+      }
       case SYS_ISDIR:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
          f->R.rax = isdir(f->R.rdi);
          break;
       case SYS_INUMBER:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
          f->R.rax = inumber(f->R.rdi);
          break;
       case SYS_SYMLINK:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
-         assert_valid_useraddr(f->R.rsi, f->rsp);
-         f->R.rax = symlink(f->R.rdi, f->R.rsi);
+         kstr = copy_in_string((const char *) f->R.rdi);
+         kstr2 = copy_in_string((const char *) f->R.rsi);
+         f->R.rax = symlink(kstr, kstr2);
+         palloc_free_page(kstr2);
+         palloc_free_page(kstr);
          break;
       case SYS_MOUNT:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
-         assert_valid_useraddr(f->R.rsi, f->rsp);
-         assert_valid_useraddr(f->R.rdx, f->rsp);
-         f->R.rax = mount(f->R.rdi, f->R.rsi, f->R.rdx);
+         kstr = copy_in_string((const char *) f->R.rdi);
+         f->R.rax = mount(kstr, f->R.rsi, f->R.rdx);
+         palloc_free_page(kstr);
          break;
       case SYS_UMOUNT:
-         assert_valid_useraddr(f->R.rdi, f->rsp);
-         f->R.rax = umount(f->R.rdi); 
+         kstr = copy_in_string((const char *) f->R.rdi);
+         f->R.rax = umount(kstr); 
+         palloc_free_page(kstr);
          break;
       //case default:
       //   PANIC("Unknown syscall\n");
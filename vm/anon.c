@@ -1,9 +1,18 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include "vm/zswap.h"
 #include "devices/disk.h"
+#include "filesys/file.h"
 #include <bitmap.h>
+#include <stdio.h>
+#include <string.h>
 #include "threads/mmu.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
 #define LOG 0
 
 /* DO NOT MODIFY BELOW LINE */
@@ -23,6 +32,58 @@ static const struct page_operations anon_ops = {
 static size_t PAGE_PER_DISK = PGSIZE / DISK_SECTOR_SIZE;
 static struct bitmap *swap_table;
 
+static size_t slot_cnt;
+
+/* Number of pages referring to each swap slot. A page shared
+   copy-on-write is swapped out once for all of its sharers. */
+static uint16_t *swap_refs;
+/* Page table of the process that swapped each slot out. */
+static uint64_t **swap_owner;
+/* Protects swap_refs, swap_owner and the swap cache. */
+static struct lock slot_lock;
+
+/* Swap readahead. A swap-in fault asks the readahead thread to read
+   the next swap_ra_window slots of the same process into the swap
+   cache, where a fault on them soon after finds them without waiting
+   for the disk. Set by -swap-ra=N; 0 turns readahead off. */
+size_t swap_ra_window = 4;
+#define SWAP_CACHE_SIZE 32
+#define SWAP_CACHE_TTL TIMER_FREQ   /* Ticks a cached slot stays useful */
+
+struct swap_cache_entry {
+   disk_sector_t swap_loc;    /* Slot held, -1 if the entry is free */
+   bool ready;                /* Contents have been read */
+   int64_t tick;              /* When the contents were read */
+   void *kva;                 /* Page of contents */
+};
+static struct swap_cache_entry swap_cache[SWAP_CACHE_SIZE];
+
+/* Pending readahead request, taken by the readahead thread. */
+static struct semaphore ra_sema;
+static bool ra_pending;
+static disk_sector_t ra_start;
+static uint64_t *ra_owner;
+
+/* Slots are handed out from runs of SWAP_CLUSTER free slots, so
+   pages evicted one after another sit next to each other on the
+   swap disk. Only used by swap_out, which the caller serializes. */
+#define SWAP_CLUSTER 16
+static size_t cluster_next;   /* Next slot of the current run */
+static size_t cluster_end;    /* End of the current run */
+
+/* Swap statistics, for swap_print_stats() */
+static long long swap_out_cnt, swap_in_cnt;     /* Pages */
+static int64_t swap_out_ticks, swap_in_ticks;   /* Time spent on the disk */
+static long long swap_ra_cnt, swap_ra_hits;     /* Pages read ahead, used */
+static long long swap_zswap_hits;               /* Swap-ins from zswap */
+static long long swap_dropped, swap_refaulted;  /* Clean text pages */
+
+static size_t swap_slot_alloc (void);
+static void swap_slot_put (disk_sector_t swap_loc);
+static bool swap_cache_get (disk_sector_t swap_loc, void *kva);
+static void swap_ra_request (disk_sector_t swap_loc, uint64_t *owner);
+static void swap_ra_thread (void *aux);
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
@@ -39,6 +100,29 @@ vm_anon_init (void) {
    if(swap_table == NULL)
       exit(-1);
 
+   slot_cnt = bit_cnt;
+   swap_refs = calloc(bit_cnt, sizeof *swap_refs);
+   swap_owner = calloc(bit_cnt, sizeof *swap_owner);
+   if(swap_refs == NULL || swap_owner == NULL)
+      exit(-1);
+   lock_init(&slot_lock);
+   zswap_init(swap_disk, bit_cnt);
+
+   // Readahead needs the cache; without pages for it, do without
+   if(swap_ra_window > SWAP_CACHE_SIZE / 2)
+      swap_ra_window = SWAP_CACHE_SIZE / 2;
+   for(size_t i = 0; i < SWAP_CACHE_SIZE && swap_ra_window > 0; i++)
+   {
+      swap_cache[i].swap_loc = -1;
+      swap_cache[i].kva = palloc_get_page(0);
+      if(swap_cache[i].kva == NULL)
+         swap_ra_window = 0;
+   }
+   sema_init(&ra_sema, 0);
+   if(swap_ra_window > 0
+         && thread_create("swap-ra", PRI_DEFAULT, swap_ra_thread, NULL) == TID_ERROR)
+      swap_ra_window = 0;
+
    return;
 }
 
@@ -68,6 +152,7 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 
    // For swap
    anon_page->swap_loc = -1;
+   anon_page->file = NULL;
    /* END */
 
    return true;
@@ -79,17 +164,39 @@ anon_swap_in (struct page *page, void *kva) {
    struct anon_page *anon_page = &page->anon;
 
    disk_sector_t swap_loc = anon_page->swap_loc;
-   size_t start = swap_loc * PAGE_PER_DISK;
-   // Read page from each disk sector
-   for(size_t i = 0; i < PAGE_PER_DISK; i++) {
-      disk_read(swap_disk, start + i,   kva + (DISK_SECTOR_SIZE * i));
+   // A clean page of the executable was dropped: read it back from there
+   if(swap_loc == (disk_sector_t) -1)
+   {
+      ASSERT(anon_page->file != NULL);
+      if(file_read_at(anon_page->file, kva, anon_page->page_read_bytes,
+               anon_page->offset) != (off_t) anon_page->page_read_bytes)
+         return false;
+      memset(kva + anon_page->page_read_bytes, 0,
+             PGSIZE - anon_page->page_read_bytes);
+      swap_refaulted++;
+      return vm_install_page(page, kva, anon_page->writable);
    }
+   if(zswap_load(swap_loc, kva))
+      swap_zswap_hits++;
+   else if(swap_cache_get(swap_loc, kva))
+      swap_ra_hits++;
+   else
+   {
+      int64_t start = timer_ticks();
+      // Read the whole page with one disk command
+      disk_read_multiple(swap_disk, swap_loc * PAGE_PER_DISK, kva, PAGE_PER_DISK);
+      swap_in_ticks += timer_elapsed(start);
+      swap_in_cnt++;
+   }
+   // The slots after this one were likely evicted along with it
+   swap_ra_request(swap_loc, page->pml4);
 
-   // The file that was in this location is swapped in, so we can use this bit now
-   bitmap_set(swap_table, swap_loc, false);
+   // Once every sharer has read it back, this slot can be used again
+   swap_slot_put(swap_loc);
+   anon_page->swap_loc = -1;
 
    // Mapping in physical memory
-   install_page(page->va, kva, anon_page->writable);
+   vm_install_page(page, kva, anon_page->writable);
    
    return true;
 }
@@ -99,36 +206,254 @@ static bool
 anon_swap_out (struct page *page) {
    struct anon_page *anon_page = &page->anon;
 
-   size_t start = 0;
-   int cnt = 1;
-   bool value = false;
-   disk_sector_t swap_loc = bitmap_scan(swap_table, start, cnt, value); 
-   ASSERT(swap_loc < BITMAP_ERROR);
-
-   size_t write_start = swap_loc * PAGE_PER_DISK;
-   // Write page to each disk sector
-   for(size_t i = 0; i < PAGE_PER_DISK; i++) {
-      disk_write(swap_disk, write_start + i,
-                  (page->frame->kva) + (DISK_SECTOR_SIZE * i));
+   // Read-only executable pages are still what the file holds
+   if(anon_page->file != NULL)
+   {
+      anon_page->swap_loc = -1;
+      swap_dropped++;
+      return true;
+   }
+
+   size_t swap_loc = swap_slot_alloc();
+   ASSERT(swap_loc != BITMAP_ERROR);
+
+   // Keep it compressed in memory if we can, else write it to the disk
+   if(!zswap_store(swap_loc, page->frame->kva))
+   {
+      int64_t start = timer_ticks();
+      // Write the whole page with one disk command
+      disk_write_multiple(swap_disk, swap_loc * PAGE_PER_DISK,
+                           page->frame->kva, PAGE_PER_DISK);
+      swap_out_ticks += timer_elapsed(start);
+      swap_out_cnt++;
    }
 
-   // The file is swapped out to this location, so we can't use this bit now
-   bitmap_set(swap_table, swap_loc, true);
    // Save swap_loc for later swap_in
    anon_page->swap_loc = swap_loc;
+   lock_acquire(&slot_lock);
+   swap_refs[swap_loc] = 1;
+   swap_owner[swap_loc] = page->pml4;
+   lock_release(&slot_lock);
 
    return true;
 }
 
+/* Hand out the next slot of the current run of free slots, or start a
+   new run. Next-fit: runs are looked for after the last one instead of
+   rescanning the (mostly full) front of the table every time. When no
+   whole run is free any more, fall back to single slots. */
+static size_t
+swap_slot_alloc (void) {
+   if(cluster_next == cluster_end)
+   {
+      size_t start = bitmap_scan_and_flip_next_fit(swap_table, SWAP_CLUSTER,
+                                                   false);
+      if(start == BITMAP_ERROR)
+         return bitmap_scan_and_flip_next_fit(swap_table, 1, false);
+      cluster_next = start;
+      cluster_end = start + SWAP_CLUSTER;
+   }
+   return cluster_next++;
+}
+
+/* Drop one reference to the swap slot SWAP_LOC, freeing the slot
+   when it was the last one. */
+static void
+swap_slot_put (disk_sector_t swap_loc) {
+   lock_acquire(&slot_lock);
+   ASSERT(swap_refs[swap_loc] > 0);
+   if(--swap_refs[swap_loc] == 0)
+   {
+      // The slot will be written again: forget what was read of it
+      for(size_t i = 0; i < SWAP_CACHE_SIZE; i++)
+         if(swap_cache[i].swap_loc == swap_loc)
+            swap_cache[i].swap_loc = -1;
+      swap_owner[swap_loc] = NULL;
+      zswap_invalidate(swap_loc);
+      bitmap_reset(swap_table, swap_loc);
+   }
+   lock_release(&slot_lock);
+}
+
+/* Copy slot SWAP_LOC into KVA if the swap cache has read it recently,
+   and return true if so. */
+static bool
+swap_cache_get (disk_sector_t swap_loc, void *kva) {
+   bool hit = false;
+
+   if(swap_ra_window == 0)
+      return false;
+
+   lock_acquire(&slot_lock);
+   for(size_t i = 0; i < SWAP_CACHE_SIZE; i++)
+   {
+      struct swap_cache_entry *e = &swap_cache[i];
+      if(e->swap_loc == swap_loc && e->ready
+            && timer_elapsed(e->tick) < SWAP_CACHE_TTL)
+      {
+         memcpy(kva, e->kva, PGSIZE);
+         hit = true;
+         break;
+      }
+   }
+   lock_release(&slot_lock);
+   return hit;
+}
+
+/* Ask the readahead thread to read the slots following SWAP_LOC that
+   the process with page table OWNER swapped out. A newer request
+   replaces one that has not been started yet. */
+static void
+swap_ra_request (disk_sector_t swap_loc, uint64_t *owner) {
+   bool idle;
+
+   if(swap_ra_window == 0)
+      return;
+
+   lock_acquire(&slot_lock);
+   ra_start = swap_loc + 1;
+   ra_owner = owner;
+   idle = !ra_pending;
+   ra_pending = true;
+   lock_release(&slot_lock);
+   if(idle)
+      sema_up(&ra_sema);
+}
+
+/* Return a swap cache entry to read a slot into: a free one, else the
+   one read longest ago. Must be called with slot_lock held. */
+static struct swap_cache_entry *
+swap_cache_victim (void) {
+   struct swap_cache_entry *victim = &swap_cache[0];
+
+   for(size_t i = 0; i < SWAP_CACHE_SIZE; i++)
+   {
+      struct swap_cache_entry *e = &swap_cache[i];
+      if(e->swap_loc == (disk_sector_t) -1)
+         return e;
+      if(e->ready && e->tick < victim->tick)
+         victim = e;
+   }
+   return victim;
+}
+
+/* Return true if the swap cache holds, or is reading, slot SWAP_LOC.
+   Must be called with slot_lock held. */
+static bool
+swap_cache_has (disk_sector_t swap_loc) {
+   for(size_t i = 0; i < SWAP_CACHE_SIZE; i++)
+      if(swap_cache[i].swap_loc == swap_loc
+            && (!swap_cache[i].ready
+                || timer_elapsed(swap_cache[i].tick) < SWAP_CACHE_TTL))
+         return true;
+   return false;
+}
+
+/* Readahead thread: reads the slots of each request into the swap
+   cache, one page at a time, while the faulting process goes on. */
+static void
+swap_ra_thread (void *aux UNUSED) {
+   for(;;)
+   {
+      disk_sector_t start;
+      uint64_t *owner;
+
+      sema_down(&ra_sema);
+      lock_acquire(&slot_lock);
+      start = ra_start;
+      owner = ra_owner;
+      ra_pending = false;
+      lock_release(&slot_lock);
+
+      for(disk_sector_t slot = start;
+            slot < start + swap_ra_window && slot < slot_cnt; slot++)
+      {
+         struct swap_cache_entry *e;
+
+         lock_acquire(&slot_lock);
+         // Only slots still in use by the same process and not held
+         // in memory by zswap are worth it
+         if(swap_refs[slot] == 0 || swap_owner[slot] != owner
+               || swap_cache_has(slot) || zswap_contains(slot))
+         {
+            lock_release(&slot_lock);
+            continue;
+         }
+         e = swap_cache_victim();
+         e->swap_loc = slot;
+         e->ready = false;
+         lock_release(&slot_lock);
+
+         disk_read_multiple(swap_disk, slot * PAGE_PER_DISK, e->kva,
+                            PAGE_PER_DISK);
+
+         lock_acquire(&slot_lock);
+         // The slot may have been freed while we were reading it
+         if(e->swap_loc == slot)
+         {
+            e->ready = true;
+            e->tick = timer_ticks();
+            swap_ra_cnt++;
+         }
+         lock_release(&slot_lock);
+      }
+   }
+}
+
+/* Let PAGE refer to the swap slot holding the swapped out anonymous
+   page SRC, as when a copy-on-write page is evicted or a swapped out
+   page is inherited by fork(). */
+void
+anon_swap_share (struct page *page, struct page *src) {
+   disk_sector_t swap_loc = src->anon.swap_loc;
+
+   page->anon.swap_loc = swap_loc;
+   if(swap_loc == (disk_sector_t) -1)
+      return;
+
+   lock_acquire(&slot_lock);
+   ASSERT(swap_refs[swap_loc] > 0 && swap_refs[swap_loc] < UINT16_MAX);
+   swap_refs[swap_loc]++;
+   lock_release(&slot_lock);
+}
+
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
    struct anon_page *anon_page = &page->anon;
-   // Nothing to do
-   // No dynamically allocated memory
+   // Give back the swap slot of a page that is still swapped out
+   if(page->frame == NULL && anon_page->swap_loc != (disk_sector_t) -1)
+   {
+      swap_slot_put(anon_page->swap_loc);
+      anon_page->swap_loc = -1;
+   }
 }
 
 /* Our Implementation of non-static version */
 void _anon_destroy (struct page *page) {
    return anon_destroy(page);
-}
\ No newline at end of file
+}
+
+/* Print swap statistics. */
+void
+swap_print_stats (void) {
+   printf("Swap: %lld pages out in %"PRId64" ticks, %lld pages in in %"PRId64" ticks\n",
+          swap_out_cnt, swap_out_ticks, swap_in_cnt, swap_in_ticks);
+   if(swap_out_ticks > 0)
+      printf("Swap: out %lld kB/s\n",
+             swap_out_cnt * (PGSIZE / 1024) * TIMER_FREQ / swap_out_ticks);
+   if(swap_in_ticks > 0)
+      printf("Swap: in %lld kB/s\n",
+             swap_in_cnt * (PGSIZE / 1024) * TIMER_FREQ / swap_in_ticks);
+   if(swap_dropped > 0)
+      printf("Swap: %lld clean executable pages dropped instead of swapped, "
+             "%lld read back from the file\n", swap_dropped, swap_refaulted);
+   if(swap_ra_window > 0)
+      printf("Swap: %lld pages read ahead, %lld faults served from them\n",
+             swap_ra_cnt, swap_ra_hits);
+   long long swap_ins = swap_in_cnt + swap_ra_hits + swap_zswap_hits;
+   if(swap_ins > 0)
+      printf("Swap: %lld of %lld swap-ins served by zswap (%lld%%)\n",
+             swap_zswap_hits, swap_ins, swap_zswap_hits * 100 / swap_ins);
+   zswap_print_stats();
+}
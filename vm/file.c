@@ -5,6 +5,9 @@
 #include "userprog/process.h"
 #include "threads/mmu.h"
 #include "filesys/file.h"
+#include "threads/vaddr.h"
+#include "vm/vma.h"
+#include <round.h>
 /* END */
 
 static bool file_backed_swap_in (struct page *page, void *kva);
@@ -44,7 +47,7 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
    struct file_page *file_page UNUSED = &page->file;
-   install_page(page->va, kva, file_page->writable);
+   vm_install_page(page, kva, file_page->writable);
    file_read_at(file_page->file, kva, file_page->page_read_bytes, file_page->offset);
    memset (kva + file_page->page_read_bytes, 0, PGSIZE - file_page->page_read_bytes);
    page->is_loaded = true;
@@ -56,11 +59,14 @@ file_backed_swap_in (struct page *page, void *kva) {
 static bool
 file_backed_swap_out (struct page *page) {
    struct file_page *file_page UNUSED = &page->file;
-   if (pml4_is_dirty(thread_current()->pml4, page->va))
+   // The victim may belong to another process, so go through its own
+   // page table and frame rather than the current ones
+   struct frame *frame = page->frame;
+   if (pml4_is_dirty(page->pml4, page->va))
    {
-      file_write_at(file_page->file, page->va, file_page->page_read_bytes, file_page->offset);
+      file_write_at(file_page->file, frame->kva, file_page->page_read_bytes, file_page->offset);
    }
-   pml4_set_dirty(thread_current()->pml4, page->va, false);
+   pml4_set_dirty(page->pml4, page->va, false);
    page->is_loaded = false;
    // printf("FILE SWAP OUT VA 0x%lx KVA 0x%lx\n", page->va, page->frame->kva);
    return true;
@@ -75,26 +81,10 @@ file_backed_destroy (struct page *page) {
       file_write_at(file_page->file, page->va, file_page->page_read_bytes, file_page->offset);
    }
    page->is_loaded = false;
-   file_close(file_page->file);
+   // The handle belongs to the area of the mapping, which closes it
 }
 
 
-struct mmap_va *find_mmap_file (void *addr) {
-   struct thread *t = thread_current();
-   struct list *mmap_list = &t->mmap_list;
-   struct list_elem *e = list_begin(mmap_list);
-   struct list_elem *nexte;
-   for (e; e != list_end(mmap_list); e = nexte)
-   {
-      nexte = list_next(e);
-      struct mmap_va *mmap_va = list_entry (e, struct mmap_va, mmaplist_elem);
-      ASSERT(mmap_va != NULL);
-      if (mmap_va->start_va == addr)
-         return mmap_va;
-   }
-   return NULL;
-}
-
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
@@ -102,65 +92,52 @@ do_mmap (void *addr, size_t length, int writable,
    if (addr == 0) return NULL;
    if (pg_ofs (addr) != 0) return NULL;
    if (length == 0) return NULL;
-   if (find_mmap_file(addr) != NULL) return NULL;
    if (offset > PGSIZE) return NULL;
-   uint8_t *map_addr = addr;
-   struct mmap_va *mmap_va = (struct mmap_va *)malloc(sizeof(struct mmap_va));
-   if (mmap_va == NULL) return NULL;
-   memset(mmap_va, 0, sizeof(struct mmap_va));
-   mmap_va->start_va = addr;
-   list_push_back (&thread_current()->mmap_list, &mmap_va->mmaplist_elem);
-   list_init(&mmap_va->page_list);
-   struct file *refile;
-   while(length > 0) {
-      size_t read_bytes = length < PGSIZE ? length : PGSIZE;
-      size_t zero_bytes = PGSIZE - read_bytes;
-      // printf("addr 0x%lx pg_round 0x%lx\n", addr, pg_round_down(addr));
-      struct temp *temp = (struct temp*) malloc(sizeof(struct temp));
-      refile = file_reopen(file);
-      temp->file = refile;
-      ASSERT(temp->file != NULL);
-      temp->page_read_bytes = read_bytes;
-      temp->writable = writable;
-      temp->offset = offset;
-      
-      // printf("MMAP VA 0x%lx\n", addr);
-      if (!vm_alloc_page_with_initializer (VM_FILE, addr, 
-         writable, lazy_load_segment, temp))
-         return NULL;
+   uint8_t *end = (uint8_t *) addr + ROUND_UP (length, PGSIZE);
+   if (end <= (uint8_t *) addr || !is_user_vaddr (end - 1)) return NULL;
 
-      struct page* page = spt_find_page(&thread_current()->spt, addr); 
-      ASSERT(page != NULL);
-      list_push_back(&mmap_va->page_list, &page->mmap_elem);
-
-      length -= read_bytes;
-      addr += PGSIZE;
-      offset += read_bytes;
+   // One area for the whole mapping; its pages are created as they fault
+   struct supplemental_page_table *spt = &thread_current()->spt;
+   bool holdlock = lock_held_by_current_thread(&spt->lock);
+   if (!holdlock)
+      lock_acquire(&spt->lock);
+   struct vma *vma = NULL;
+   struct file *refile = vma_overlaps(spt, addr, end) ? NULL : file_reopen(file);
+   if (refile != NULL)
+   {
+      vma = vma_create(spt, addr, end, VM_FILE, writable, refile, offset, length);
+      if (vma == NULL)
+         file_close(refile);
    }
-   return map_addr; 
+   if (!holdlock)
+      lock_release(&spt->lock);
+   return vma != NULL ? addr : NULL;
 }
 
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
-   struct mmap_va *mmap_va = find_mmap_file(addr);
-   if (mmap_va == NULL) exit(-1);
-   struct list *page_list = &mmap_va->page_list;
-   struct list_elem *e = list_begin(page_list);
-   struct list_elem *nexte;
-   for (e; e != list_end(page_list); e = nexte)
+   struct supplemental_page_table *spt = &thread_current()->spt;
+   // The prefetch thread may be changing the areas and pages of spt
+   bool holdlock = lock_held_by_current_thread(&spt->lock);
+   if (!holdlock)
+      lock_acquire(&spt->lock);
+   struct vma *vma = vma_find(spt, addr);
+   if (vma == NULL || vma->start != addr || VM_TYPE(vma->type) != VM_FILE)
    {
-      nexte = list_next(e);
-      struct page *page = list_entry(e, struct page, mmap_elem);
-      list_remove(e);
-      if (page->is_loaded)
-      {
-         struct list_elem *frame_elem = &page->frame->elem;
-         list_remove(frame_elem);
-      }
-      spt_remove_page(&thread_current()->spt, page);
+      if (!holdlock)
+         lock_release(&spt->lock);
+      exit(-1);
    }
-   list_remove (&mmap_va->mmaplist_elem);
-   free(mmap_va);
-}
\ No newline at end of file
+   // Only the pages that were faulted in exist, and only they are written back
+   for (uint8_t *va = vma->start; va < vma->end; va += PGSIZE)
+   {
+      struct page *page = spt_find_page(spt, va);
+      if (page != NULL)
+         spt_remove_page(spt, page);
+   }
+   vma_remove(spt, vma);
+   if (!holdlock)
+      lock_release(&spt->lock);
+}
@@ -0,0 +1,578 @@
+/* policy.c: Page replacement policies. */
+
+#include "vm/policy.h"
+#include <debug.h>
+#include <string.h>
+#include "lib/kernel/hash.h"
+#include "lib/kernel/list.h"
+#include "threads/malloc.h"
+#include "threads/vmalloc.h"
+#include "vm/vm.h"
+
+/* Ghost table: identities of pages evicted a short while ago, oldest
+ * first, so that a policy can tell that a page it is given back was in
+ * memory recently. Bounded to MAX entries; the oldest ones are dropped
+ * beyond that. */
+struct ghost {
+	struct hash_elem elem;
+	struct list_elem fifo_elem;
+	uint64_t *pml4;
+	void *va;
+};
+
+struct ghost_table {
+	struct hash hash;
+	struct list fifo;
+	size_t cnt;
+	size_t max;
+};
+
+static uint64_t
+ghost_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+	const struct ghost *g = hash_entry (e, struct ghost, elem);
+	return hash_bytes (&g->pml4, sizeof g->pml4)
+		^ hash_bytes (&g->va, sizeof g->va);
+}
+
+static bool
+ghost_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED)
+{
+	const struct ghost *a = hash_entry (a_, struct ghost, elem);
+	const struct ghost *b = hash_entry (b_, struct ghost, elem);
+
+	if (a->pml4 != b->pml4)
+		return a->pml4 < b->pml4;
+	return a->va < b->va;
+}
+
+static void
+ghost_init (struct ghost_table *gt, size_t max)
+{
+	if (!hash_init (&gt->hash, ghost_hash, ghost_less, NULL))
+		PANIC ("ghost table: out of memory");
+	list_init (&gt->fifo);
+	gt->cnt = 0;
+	gt->max = max;
+}
+
+/* Remember that the page at VA in PML4 was evicted. Return true if that
+ * made the oldest entry expire. */
+static bool
+ghost_add (struct ghost_table *gt, uint64_t *pml4, void *va)
+{
+	struct ghost *g;
+
+	if (gt->max == 0)
+		return false;
+	g = malloc (sizeof *g);
+	if (g == NULL)
+		return false;
+	g->pml4 = pml4;
+	g->va = va;
+	if (hash_insert (&gt->hash, &g->elem) != NULL)
+	{
+		free (g);
+		return false;
+	}
+	list_push_back (&gt->fifo, &g->fifo_elem);
+	if (++gt->cnt <= gt->max)
+		return false;
+
+	g = list_entry (list_pop_front (&gt->fifo), struct ghost, fifo_elem);
+	hash_delete (&gt->hash, &g->elem);
+	free (g);
+	gt->cnt--;
+	return true;
+}
+
+/* Forget the page at VA in PML4 and return true if it was remembered. */
+static bool
+ghost_take (struct ghost_table *gt, uint64_t *pml4, void *va)
+{
+	struct ghost key, *g;
+	struct hash_elem *e;
+
+	key.pml4 = pml4;
+	key.va = va;
+	e = hash_delete (&gt->hash, &key.elem);
+	if (e == NULL)
+		return false;
+	g = hash_entry (e, struct ghost, elem);
+	list_remove (&g->fifo_elem);
+	free (g);
+	gt->cnt--;
+	return true;
+}
+
+/* Forget every page of PML4. */
+static void
+ghost_purge (struct ghost_table *gt, uint64_t *pml4)
+{
+	struct list_elem *e = list_begin (&gt->fifo);
+
+	while (e != list_end (&gt->fifo))
+	{
+		struct ghost *g = list_entry (e, struct ghost, fifo_elem);
+
+		e = list_next (e);
+		if (g->pml4 != pml4)
+			continue;
+		list_remove (&g->fifo_elem);
+		hash_delete (&gt->hash, &g->elem);
+		free (g);
+		gt->cnt--;
+	}
+}
+
+/* Return the frame at the front of LIST after moving it to the back. */
+static struct list_elem *
+rotate (struct list *list)
+{
+	struct list_elem *e = list_pop_front (list);
+	list_push_back (list, e);
+	return e;
+}
+
+
+/* CLOCK: second chance over the frame table. The hand keeps its place
+ * between calls, so each call resumes where the previous one stopped.
+ * A recently accessed frame has its access bit cleared and is passed
+ * over; the first frame found with the bit already clear is evicted. */
+
+static size_t clock_cnt;
+static size_t clock_hand;		/* Next entry the clock looks at */
+
+static void
+clock_init (size_t frame_cnt)
+{
+	clock_cnt = frame_cnt;
+	clock_hand = 0;
+}
+
+static struct frame *
+clock_get_victim (void)
+{
+	// Two full sweeps clear every access bit, so a third means nothing
+	// is evictable at all
+	for (size_t i = 0; i <= clock_cnt * 3; i++)
+	{
+		struct frame *frame = vm_frame_at (clock_hand);
+
+		clock_hand = (clock_hand + 1) % clock_cnt;
+		if (!vm_frame_evictable (frame))
+			continue;
+		if (vm_frame_accessed (frame))	// Second chance
+			continue;
+		if (vm_frame_prepare_evict (frame))
+			return frame;
+	}
+	return NULL;
+}
+
+static const struct vm_policy clock_policy = {
+	.name = "clock",
+	.init = clock_init,
+	.get_victim = clock_get_victim,
+};
+
+
+/* 2Q (Johnson and Shasha). A page brought in for the first time goes
+ * to the FIFO A1in. Pages evicted from A1in are remembered in the
+ * ghost queue A1out, and a page faulted back in while remembered there
+ * has shown it is reused, so it goes to Am, which is managed as a
+ * clock. A1in is kept to a quarter of memory and A1out remembers half
+ * of memory worth of pages. Scanning of pages that cannot be evicted
+ * falls through to the other queue. */
+
+struct twoq_entry {
+	struct list_elem elem;
+	struct list *queue;		/* &twoq_in, &twoq_main, or NULL */
+};
+
+static struct twoq_entry *twoq_entries;
+static struct list twoq_in;		/* A1in, oldest first */
+static struct list twoq_main;		/* Am, in clock order */
+static size_t twoq_in_cnt, twoq_in_max;
+static struct ghost_table twoq_out;	/* A1out */
+
+static void
+twoq_init (size_t frame_cnt)
+{
+	twoq_entries = vmalloc (frame_cnt * sizeof *twoq_entries,
+			PAL_ZERO | PAL_ASSERT);
+	list_init (&twoq_in);
+	list_init (&twoq_main);
+	twoq_in_cnt = 0;
+	twoq_in_max = frame_cnt / 4 > 0 ? frame_cnt / 4 : 1;
+	ghost_init (&twoq_out, frame_cnt / 2);
+}
+
+static void
+twoq_frame_used (struct frame *frame)
+{
+	struct twoq_entry *e = &twoq_entries[vm_frame_index (frame)];
+	uint64_t *pml4;
+	void *va;
+
+	vm_frame_owner (frame, &pml4, &va);
+	if (ghost_take (&twoq_out, pml4, va))
+		e->queue = &twoq_main;
+	else
+	{
+		e->queue = &twoq_in;
+		twoq_in_cnt++;
+	}
+	list_push_back (e->queue, &e->elem);
+}
+
+static void
+twoq_frame_freed (struct frame *frame)
+{
+	struct twoq_entry *e = &twoq_entries[vm_frame_index (frame)];
+
+	if (e->queue == NULL)
+		return;
+	if (e->queue == &twoq_in)
+		twoq_in_cnt--;
+	list_remove (&e->elem);
+	e->queue = NULL;
+}
+
+/* Move FRAME to the old end of A1in, where it is evicted next. */
+static void
+twoq_frame_deactivate (struct frame *frame)
+{
+	struct twoq_entry *e = &twoq_entries[vm_frame_index (frame)];
+
+	if (e->queue == NULL)
+		return;
+	if (e->queue == &twoq_main)
+	{
+		e->queue = &twoq_in;
+		twoq_in_cnt++;
+	}
+	list_remove (&e->elem);
+	list_push_front (&twoq_in, &e->elem);
+}
+
+static struct frame *
+twoq_frame (struct list_elem *elem)
+{
+	struct twoq_entry *e = list_entry (elem, struct twoq_entry, elem);
+	return vm_frame_at (e - twoq_entries);
+}
+
+/* Evict the oldest evictable page of A1in, remembering it in A1out. */
+static struct frame *
+twoq_scan_in (void)
+{
+	struct list_elem *elem;
+
+	for (elem = list_begin (&twoq_in); elem != list_end (&twoq_in);
+			elem = list_next (elem))
+	{
+		struct frame *frame = twoq_frame (elem);
+		uint64_t *pml4;
+		void *va;
+
+		if (!vm_frame_evictable (frame) || !vm_frame_prepare_evict (frame))
+			continue;
+		vm_frame_owner (frame, &pml4, &va);
+		ghost_add (&twoq_out, pml4, va);
+		return frame;
+	}
+	return NULL;
+}
+
+/* Run the clock over Am. */
+static struct frame *
+twoq_scan_main (void)
+{
+	size_t i, cnt = list_size (&twoq_main);
+
+	for (i = 0; i < cnt * 2 + 1 && !list_empty (&twoq_main); i++)
+	{
+		struct frame *frame = twoq_frame (rotate (&twoq_main));
+
+		if (!vm_frame_evictable (frame) || vm_frame_accessed (frame))
+			continue;
+		if (vm_frame_prepare_evict (frame))
+			return frame;
+	}
+	return NULL;
+}
+
+static struct frame *
+twoq_get_victim (void)
+{
+	struct frame *frame = NULL;
+
+	if (twoq_in_cnt > twoq_in_max || list_empty (&twoq_main))
+		frame = twoq_scan_in ();
+	if (frame == NULL)
+		frame = twoq_scan_main ();
+	if (frame == NULL)
+		frame = twoq_scan_in ();
+	return frame;
+}
+
+static void
+twoq_forget (uint64_t *pml4)
+{
+	ghost_purge (&twoq_out, pml4);
+}
+
+static const struct vm_policy twoq_policy = {
+	.name = "2q",
+	.init = twoq_init,
+	.frame_used = twoq_frame_used,
+	.frame_freed = twoq_frame_freed,
+	.frame_deactivate = twoq_frame_deactivate,
+	.get_victim = twoq_get_victim,
+	.forget = twoq_forget,
+};
+
+
+/* CLOCK-Pro (Jiang, Chen and Zhang). Resident pages are hot or cold
+ * and sit on one clock. A cold page starts a test period when it is
+ * brought in or found accessed; a cold page accessed again during its
+ * test period has a small reuse distance and becomes hot. The cold
+ * hand evicts cold pages and the hot hand turns hot pages that were
+ * not accessed since it last passed into cold ones, keeping the number
+ * of hot pages within memory minus the cold target.
+ *
+ * A cold page evicted during its test period is remembered as a
+ * non-resident page. Faulting it back in means the cold target was
+ * too small, so it grows; a test period that runs out means it was
+ * large enough, so it shrinks. Here non-resident pages are kept in a
+ * ghost table bounded to memory size rather than on the clock itself,
+ * and a test period runs out when the entry expires from that table. */
+
+struct cp_entry {
+	struct list_elem elem;
+	bool listed;		/* On the clock */
+	bool hot;
+	bool test;		/* Cold page in its test period */
+};
+
+static struct cp_entry *cp_entries;
+static struct list cp_clock;
+static struct list_elem *cp_hand_cold, *cp_hand_hot;	/* NULL: list start */
+static size_t cp_cnt;			/* Frames of memory */
+static size_t cp_hot_cnt;
+static size_t cp_cold_target;
+static struct ghost_table cp_nonresident;
+
+static void
+cp_init (size_t frame_cnt)
+{
+	cp_entries = vmalloc (frame_cnt * sizeof *cp_entries,
+			PAL_ZERO | PAL_ASSERT);
+	list_init (&cp_clock);
+	cp_hand_cold = cp_hand_hot = NULL;
+	cp_cnt = frame_cnt;
+	cp_hot_cnt = 0;
+	cp_cold_target = frame_cnt / 4 > 0 ? frame_cnt / 4 : 1;
+	ghost_init (&cp_nonresident, frame_cnt);
+}
+
+static struct frame *
+cp_frame (struct list_elem *elem)
+{
+	struct cp_entry *e = list_entry (elem, struct cp_entry, elem);
+	return vm_frame_at (e - cp_entries);
+}
+
+/* Return the entry under *HAND and move the hand past it. */
+static struct cp_entry *
+cp_advance (struct list_elem **hand)
+{
+	struct list_elem *elem = *hand;
+
+	if (elem == NULL)
+		elem = list_begin (&cp_clock);
+	*hand = list_next (elem);
+	if (*hand == list_end (&cp_clock))
+		*hand = NULL;
+	return list_entry (elem, struct cp_entry, elem);
+}
+
+/* Run the hot hand until it turns one hot page cold. On the way, cold
+ * pages it passes end their test period. */
+static void
+cp_run_hand_hot (void)
+{
+	size_t i, cnt = list_size (&cp_clock);
+
+	for (i = 0; i < cnt * 2; i++)
+	{
+		struct cp_entry *e = cp_advance (&cp_hand_hot);
+		struct frame *frame = cp_frame (&e->elem);
+
+		if (!e->hot)
+		{
+			e->test = false;
+			continue;
+		}
+		if (vm_frame_accessed (frame))
+			continue;
+		e->hot = false;
+		e->test = false;
+		cp_hot_cnt--;
+		return;
+	}
+}
+
+static void
+cp_make_hot (struct cp_entry *e)
+{
+	e->hot = true;
+	e->test = false;
+	cp_hot_cnt++;
+	if (cp_hot_cnt > cp_cnt - cp_cold_target)
+		cp_run_hand_hot ();
+}
+
+static void
+cp_frame_used (struct frame *frame)
+{
+	struct cp_entry *e = &cp_entries[vm_frame_index (frame)];
+	uint64_t *pml4;
+	void *va;
+
+	/* New pages go in just behind the hot hand, the head of the clock. */
+	if (cp_hand_hot != NULL)
+		list_insert (cp_hand_hot, &e->elem);
+	else
+		list_push_back (&cp_clock, &e->elem);
+	e->listed = true;
+
+	vm_frame_owner (frame, &pml4, &va);
+	if (ghost_take (&cp_nonresident, pml4, va))
+	{
+		if (cp_cold_target < cp_cnt - 1)
+			cp_cold_target++;
+		cp_make_hot (e);
+	}
+	else
+	{
+		e->hot = false;
+		e->test = true;
+	}
+}
+
+static void
+cp_frame_freed (struct frame *frame)
+{
+	struct cp_entry *e = &cp_entries[vm_frame_index (frame)];
+
+	if (!e->listed)
+		return;
+	if (cp_hand_cold == &e->elem)
+		cp_advance (&cp_hand_cold);
+	if (cp_hand_hot == &e->elem)
+		cp_advance (&cp_hand_hot);
+	list_remove (&e->elem);
+	e->listed = false;
+	if (e->hot)
+		cp_hot_cnt--;
+	// Both hands may have been on the only entry
+	if (list_empty (&cp_clock))
+		cp_hand_cold = cp_hand_hot = NULL;
+}
+
+/* Make FRAME cold and out of its test period, so that the cold hand
+ * evicts it when it gets there and no non-resident entry is kept. */
+static void
+cp_frame_deactivate (struct frame *frame)
+{
+	struct cp_entry *e = &cp_entries[vm_frame_index (frame)];
+
+	if (!e->listed)
+		return;
+	if (e->hot)
+		cp_hot_cnt--;
+	e->hot = false;
+	e->test = false;
+}
+
+static struct frame *
+cp_get_victim (void)
+{
+	size_t i, cnt = list_size (&cp_clock);
+
+	for (i = 0; i < cnt * 4 + 1 && cnt > 0; i++)
+	{
+		struct cp_entry *e;
+		struct frame *frame;
+		uint64_t *pml4;
+		void *va;
+
+		// Every page turned out hot: cool one down
+		if (i > 0 && i % cnt == 0)
+			cp_run_hand_hot ();
+
+		e = cp_advance (&cp_hand_cold);
+		frame = cp_frame (&e->elem);
+		if (e->hot || !vm_frame_evictable (frame))
+			continue;
+		if (vm_frame_accessed (frame))
+		{
+			if (e->test)
+				cp_make_hot (e);
+			else
+				e->test = true;
+			continue;
+		}
+		if (!vm_frame_prepare_evict (frame))
+			continue;
+		if (e->test)
+		{
+			vm_frame_owner (frame, &pml4, &va);
+			if (ghost_add (&cp_nonresident, pml4, va) && cp_cold_target > 1)
+				cp_cold_target--;
+		}
+		return frame;
+	}
+	return NULL;
+}
+
+/* The test periods of the pages of PML4 end without a verdict, so the
+ * cold target stays as it is. */
+static void
+cp_forget (uint64_t *pml4)
+{
+	ghost_purge (&cp_nonresident, pml4);
+}
+
+static const struct vm_policy clock_pro_policy = {
+	.name = "clock-pro",
+	.init = cp_init,
+	.frame_used = cp_frame_used,
+	.frame_freed = cp_frame_freed,
+	.frame_deactivate = cp_frame_deactivate,
+	.get_victim = cp_get_victim,
+	.forget = cp_forget,
+};
+
+
+static const struct vm_policy *policies[] = {
+	&clock_policy, &twoq_policy, &clock_pro_policy,
+};
+
+const struct vm_policy *vm_policy = &clock_policy;
+
+/* Use the policy called NAME. Return false if there is none. */
+bool
+vm_policy_select (const char *name)
+{
+	for (size_t i = 0; i < sizeof policies / sizeof *policies; i++)
+		if (!strcmp (policies[i]->name, name))
+		{
+			vm_policy = policies[i];
+			return true;
+		}
+	return false;
+}
@@ -0,0 +1,199 @@
+/* trace.c: Pages a program touches as it starts, prefetched when it is
+ * run again. */
+
+#include "vm/trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vma.h"
+
+#define TRACE_SLOTS 16          /* Executables with a trace */
+#define TRACE_PAGES 128         /* Pages recorded per executable */
+#define TRACE_WINDOW_MS 500     /* How long the first run is recorded */
+#define TRACE_GAP 4             /* Holes up to this many pages are
+                                   prefetched along with their runs */
+
+struct vm_trace {
+	disk_sector_t inode;        /* Inode sector of the executable */
+	uint32_t version;           /* Its write version */
+	int64_t tick;               /* While recording, when to stop; once
+	                               stored, when it was last used */
+	size_t page_cnt;
+	uint8_t *pages[TRACE_PAGES];	/* Sorted once stored */
+};
+
+/* Stored traces, a slot is free while PAGE_CNT is 0. */
+static struct vm_trace traces[TRACE_SLOTS];
+static struct lock trace_lock;
+static bool trace_ready;        /* Set by vm_trace_init() */
+
+void
+vm_trace_init (void)
+{
+	lock_init (&trace_lock);
+	trace_ready = true;
+}
+
+/* Return the stored trace of INODE, or NULL. Must be called with
+ * trace_lock held. */
+static struct vm_trace *
+trace_lookup (disk_sector_t inode)
+{
+	for (size_t i = 0; i < TRACE_SLOTS; i++)
+		if (traces[i].page_cnt > 0 && traces[i].inode == inode)
+			return &traces[i];
+	return NULL;
+}
+
+/* Drop the stored trace of the inode at SECTOR, if any. A new inode
+ * there starts at write version 0 again, like the removed one did, so
+ * its trace cannot be told from the new program's. */
+void
+vm_trace_forget (disk_sector_t sector)
+{
+	struct vm_trace *t;
+
+	// The file system is formatted before vm_init()
+	if (!trace_ready)
+		return;
+	lock_acquire (&trace_lock);
+	t = trace_lookup (sector);
+	if (t != NULL)
+		t->page_cnt = 0;
+	lock_release (&trace_lock);
+}
+
+/* Have the prefetch thread load the pages of T into the address space
+ * SPT of the running process, as a few runs of contiguous pages. Must be
+ * called with trace_lock held. */
+static void
+trace_replay (struct supplemental_page_table *spt, struct vm_trace *t)
+{
+	uint64_t *pml4 = thread_current ()->pml4;
+	size_t i = 0;
+
+	while (i < t->page_cnt)
+	{
+		uint8_t *start = t->pages[i], *end = start + PGSIZE;
+
+		for (i++; i < t->page_cnt
+				&& t->pages[i] <= end + TRACE_GAP * PGSIZE; i++)
+			end = t->pages[i] + PGSIZE;
+		vm_prefetch_request (spt, pml4, start, end);
+	}
+}
+
+/* FILE, the executable of the running process, was just loaded into its
+ * address space SPT. Prefetch what it touched the last time if its trace
+ * is still good, or start recording one. */
+void
+vm_trace_start (struct supplemental_page_table *spt, struct file *file)
+{
+	struct inode *inode = get_inode_from_file (file);
+	disk_sector_t sector = inode_get_inumber (inode);
+	uint32_t version = inode_version (inode);
+	struct vm_trace *t;
+
+	ASSERT (spt->trace == NULL);
+	lock_acquire (&trace_lock);
+	t = trace_lookup (sector);
+	if (t != NULL && t->version == version)
+	{
+		t->tick = timer_ticks ();
+		trace_replay (spt, t);
+		lock_release (&trace_lock);
+		return;
+	}
+	// The executable was rewritten since it was recorded
+	if (t != NULL)
+		t->page_cnt = 0;
+	lock_release (&trace_lock);
+
+	t = malloc (sizeof *t);
+	if (t == NULL)
+		return;
+	t->inode = sector;
+	t->version = version;
+	t->tick = timer_ticks () + TRACE_WINDOW_MS * TIMER_FREQ / 1000;
+	t->page_cnt = 0;
+	spt->trace = t;
+}
+
+/* Record a fault at VA, in the area VMA of SPT, if SPT is being traced.
+ * Only pages of the executable's segments count: the stack, the heap and
+ * mappings differ from run to run. Must be called with the spt lock
+ * held. */
+void
+vm_trace_fault (struct supplemental_page_table *spt, struct vma *vma,
+		void *va)
+{
+	struct vm_trace *t = spt->trace;
+
+	if (t == NULL)
+		return;
+	if (timer_ticks () >= t->tick)
+	{
+		vm_trace_finish (spt);
+		return;
+	}
+	if (vma == NULL || vma->file == NULL || VM_TYPE (vma->type) == VM_FILE)
+		return;
+	if (t->page_cnt < TRACE_PAGES)
+		t->pages[t->page_cnt++] = pg_round_down (va);
+}
+
+static int
+compare_pages (const void *a_, const void *b_)
+{
+	uint8_t *a = *(uint8_t * const *) a_, *b = *(uint8_t * const *) b_;
+
+	return a < b ? -1 : a > b;
+}
+
+/* Stop recording SPT, if it is, and store what was recorded, replacing
+ * the least recently used trace if there is no free slot. */
+void
+vm_trace_finish (struct supplemental_page_table *spt)
+{
+	struct vm_trace *t = spt->trace, *slot;
+	size_t i, cnt;
+
+	if (t == NULL)
+		return;
+	spt->trace = NULL;
+
+	// A page evicted and faulted in again is there twice
+	qsort (t->pages, t->page_cnt, sizeof *t->pages, compare_pages);
+	for (i = cnt = 0; i < t->page_cnt; i++)
+		if (cnt == 0 || t->pages[i] != t->pages[cnt - 1])
+			t->pages[cnt++] = t->pages[i];
+	t->page_cnt = cnt;
+
+	lock_acquire (&trace_lock);
+	slot = trace_lookup (t->inode);
+	if (slot == NULL)
+	{
+		slot = &traces[0];
+		for (i = 0; i < TRACE_SLOTS; i++)
+			if (traces[i].page_cnt == 0)
+			{
+				slot = &traces[i];
+				break;
+			}
+			else if (traces[i].tick < slot->tick)
+				slot = &traces[i];
+	}
+	if (t->page_cnt > 0)
+	{
+		*slot = *t;
+		slot->tick = timer_ticks ();
+	}
+	lock_release (&trace_lock);
+	free (t);
+}
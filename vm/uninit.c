@@ -12,6 +12,9 @@
 #include "vm/uninit.h"
 /* Our Implementation */
 #include "vm/anon.h"
+#include "userprog/process.h"
+#include "filesys/file.h"
+#include "threads/malloc.h"
 #define LOG 0
 
 static bool uninit_initialize (struct page *page, void *kva);
@@ -72,15 +75,11 @@ uninit_destroy (struct page *page) {
 	/* TODO: Fill this function.
 	 * TODO: If you don't have anything to do, just return. */
 	/* Free container */
-	void *aux = uninit->aux;
-	ASSERT(aux != NULL);
-	/* When free? */
-	// free(aux)
-
-	if(VM_TYPE(VM_ANON))
-		_anon_destroy(page);
-	else if(VM_TYPE(VM_FILE))
+	struct temp *temp = uninit->aux;
+	if (temp == NULL)
 		return;
 
+	/* The file handle belongs to the area the page was created from */
+	free(temp);
 	return;
 }
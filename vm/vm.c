@@ -3,13 +3,23 @@
 #include "threads/malloc.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "vm/policy.h"
+#include "vm/vma.h"
+#include "vm/trace.h"
 #include "threads/synch.h"
 /* Our Implementation */
 #include "vm/uninit.h"
 #include "threads/vaddr.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
 #include "userprog/process.h"
+#include "userprog/exception.h"
 #include "threads/mmu.h"
 #include "threads/thread.h"
+#include "threads/vmalloc.h"
+#include <stdio.h>
+#include <string.h>
+#include <round.h>
 #define LOG 0
 
 #include "lib/kernel/hash.h"
@@ -19,12 +29,104 @@
 /* For synchronization */
 static struct lock vm_lock;
 static struct lock swap_lock;
-static struct lock copy_lock;
 
-/* Frame list */
-static struct list vm_frames;
+/* Frame table: one entry per page of the user pool, indexed by
+ * frame number, so finding the frame of a kva needs no search. */
+static struct frame *frame_table;
+static uint8_t *frame_base;		/* kva of frame_table[0] */
+static size_t frame_cnt;
+static size_t clean_hand;		/* Next entry kswapd cleans */
+
+/* Page of zeros mapped read-only for reads of untouched zero-filled
+ * anonymous pages, which get a frame of their own on the first write. */
+static void *zero_page;
+
+/* Signaled, with vm_lock, when a page stops being busy */
+static struct condition page_idle;
+
+/* Frames that kswapd looks at for dirty file pages to write back after
+ * each round of reclaim. */
+#define KSWAPD_CLEAN_CNT 64
+
+/* Fault-around window, see vm.h. Off for mmap() regions unless asked
+ * for, since a mapped file is expected to be read in page by page. */
+size_t fault_around_pages = 4;
+bool fault_around_mmap = false;
+
+/* Free user frame watermarks, in pages, see vm.h */
+size_t vm_wmark_low = 16;
+size_t vm_wmark_high = 32;
+
+/* Reclaim daemon state */
+static struct semaphore kswapd_sema;	/* Upped to wake kswapd */
+static bool kswapd_awake;		/* Set while kswapd is reclaiming */
+static void kswapd (void *aux);
+static uint64_t text_hash (const struct hash_elem *e, void *aux);
+static bool text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux);
+
+/* Reclaim statistics, for vm_print_stats() */
+static long long kswapd_reclaimed;	/* Frames freed by kswapd */
+static long long kswapd_cleaned;	/* Dirty file pages written back early */
+static long long direct_reclaimed;	/* Frames evicted by a faulting thread */
+
+/* Text cache: frames holding read-only executable pages, by inode,
+ * offset and length, so that a process running the same program maps
+ * the frame another one already loaded instead of reading the page
+ * again. Protected by vm_lock. */
+static struct hash text_cache;
+
+/* Text cache statistics, for vm_print_stats() */
+static long long text_loaded;		/* Pages read and entered */
+static long long text_shared;		/* Faults served from the cache */
+
+/* Page faults handled, for vm_print_stats() */
+static long long fault_cnt;
+
+/* Prefetch thread: loads the pages of madvise(MADV_WILLNEED) ranges and
+ * the readahead of MADV_SEQUENTIAL areas into free frames, in the
+ * background. Requests are queued with prefetch_lock; PREFETCH_CUR is the
+ * address space of the request being served. */
+#define PREFETCH_QUEUE_MAX 16
+#define SEQUENTIAL_WINDOW 16	/* Pages read ahead of a sequential fault */
+
+struct prefetch_req {
+	struct list_elem elem;
+	struct supplemental_page_table *spt;
+	uint64_t *pml4;
+	uint8_t *start, *end;
+};
+
+static struct list prefetch_queue;
+static size_t prefetch_queued;
+static struct lock prefetch_lock;
+static struct condition prefetch_ready;	/* A request was queued */
+static struct condition prefetch_done;	/* PREFETCH_CUR went back to NULL */
+static struct supplemental_page_table *prefetch_cur;
+static void prefetchd (void *aux);
+static void vm_prefetch_cancel (struct supplemental_page_table *spt);
+static void vm_sequential_fault (struct vma *vma, void *va);
+
+/* madvise() statistics, for vm_print_stats() */
+static long long prefetch_cnt;		/* Pages loaded by the prefetch thread */
+static long long dontneed_cnt;		/* Pages dropped by MADV_DONTNEED */
+static long long deactivated_cnt;	/* Pages behind a sequential fault */
+
+/* Fault-around statistics, for vm_print_stats() */
+static long long fault_around_cnt;	/* Pages populated ahead of use */
+static long long fault_around_used;	/* Of those, pages accessed later */
 
 /* Our Implementation */
+/* Map PAGE at KVA in the page table it was attached to, which is not the
+ * running process's when the prefetch thread loads it. Returns false if
+ * the page is mapped already or memory runs out. */
+bool
+vm_install_page (struct page *page, void *kva, bool writable)
+{
+	return (pml4_get_page (page->pml4, page->va) == NULL
+			&& pml4_set_page (page->pml4, page->va, kva, writable));
+}
+
 static bool add_map (struct page *page, void *kva)
 {
 	if(LOG)
@@ -33,7 +135,7 @@ static bool add_map (struct page *page, void *kva)
 	bool writable = true;
 	if(page->type == VM_ANON)
 		writable == page->anon.writable;
-	bool res = install_page(page->va, kva, writable);
+	bool res = vm_install_page(page, kva, writable);
 	return res;
 }
 
@@ -62,8 +164,10 @@ spt_less (const struct hash_elem *hea,
 }
 /* END */
 
+/* Pages claimed directly hold anonymous memory that never goes to swap. */
 static const struct page_operations page_op = {
-	.swap_in = add_map
+	.swap_in = add_map,
+	.type = VM_ANON,
 };
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
@@ -79,10 +183,35 @@ vm_init (void) {
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
 	/* TODO: Your code goes here. */
-	list_init (&vm_frames);
+	frame_base = palloc_user_pool (&frame_cnt);
+	frame_table = vmalloc (frame_cnt * sizeof *frame_table,
+			PAL_ZERO | PAL_ASSERT);
+	for (size_t i = 0; i < frame_cnt; i++)
+	{
+		frame_table[i].kva = frame_base + i * PGSIZE;
+		list_init (&frame_table[i].rmap);
+	}
+	vm_policy->init (frame_cnt);
+	hash_init (&text_cache, text_hash, text_less, NULL);
+	zero_page = palloc_get_page (PAL_ZERO | PAL_ASSERT);
 	lock_init (&vm_lock);
 	lock_init (&swap_lock);
-	lock_init (&copy_lock);
+	cond_init (&page_idle);
+
+	sema_init (&kswapd_sema, 0);
+	if (vm_wmark_high < vm_wmark_low)
+		vm_wmark_high = vm_wmark_low;
+	if (vm_wmark_low > 0
+			&& thread_create ("kswapd", PRI_DEFAULT, kswapd, NULL) == TID_ERROR)
+		vm_wmark_low = 0;
+
+	vm_trace_init ();
+	list_init (&prefetch_queue);
+	lock_init (&prefetch_lock);
+	cond_init (&prefetch_ready);
+	cond_init (&prefetch_done);
+	if (thread_create ("prefetchd", PRI_DEFAULT, prefetchd, NULL) == TID_ERROR)
+		PANIC ("vm_init: cannot start the prefetch thread");
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -102,10 +231,131 @@ page_get_type (struct page *page) {
 /* Helpers */
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
+static bool vm_claim_frame (struct page *page, struct frame *frame,
+		uint64_t *pml4);
+static struct frame *vm_get_free_frame (void);
 static struct frame *vm_evict_frame (void);
 
 /* Our Implementation */
-static struct frame *vm_frame_next(void);
+static bool vm_split_huge (struct frame *frame);
+static bool vm_try_claim_huge (struct page *page);
+static void vm_free_frame (struct page *page);
+static bool vm_handle_wp (struct page *page);
+static bool copy_page_locked (struct page *page, struct page *newpage,
+		struct supplemental_page_table *dst);
+static bool vm_map_zero_page (struct page *page);
+static bool is_zero_anon_page (struct page *page, bool *writable);
+static bool vm_text_key (struct page *page, struct text_key *key);
+static void vm_publish_text (struct page *page, const struct text_key *key);
+
+/* Text cache hash functions */
+static uint64_t
+text_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+	const struct text_key *k = &hash_entry (e, struct frame, text_elem)->text_key;
+	return hash_int (k->inode) ^ hash_int (k->ofs) ^ hash_int (k->bytes);
+}
+
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED)
+{
+	const struct text_key *a = &hash_entry (a_, struct frame, text_elem)->text_key;
+	const struct text_key *b = &hash_entry (b_, struct frame, text_elem)->text_key;
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	return a->bytes < b->bytes;
+}
+
+/* Return the frame table entry for the user pool page at KVA. */
+static inline struct frame *
+vm_frame_of (void *kva)
+{
+	size_t idx = ((uint8_t *) kva - frame_base) / PGSIZE;
+	ASSERT (idx < frame_cnt);
+	return &frame_table[idx];
+}
+
+/* Wait until no one else works on PAGE, then mark it busy: its frame is
+ * not evicted and its owner does not free it until vm_page_release().
+ * Eviction marks the pages of its victim busy when it picks it, so a
+ * fault on a page being written out waits for that to finish. */
+static void
+vm_page_acquire (struct page *page)
+{
+	lock_acquire (&vm_lock);
+	while (page->busy)
+		cond_wait (&page_idle, &vm_lock);
+	page->busy = true;
+	lock_release (&vm_lock);
+}
+
+/* Like vm_page_acquire(), but return false instead of waiting. */
+static bool
+vm_page_try_acquire (struct page *page)
+{
+	bool res;
+
+	lock_acquire (&vm_lock);
+	res = !page->busy;
+	if (res)
+		page->busy = true;
+	lock_release (&vm_lock);
+	return res;
+}
+
+/* Mark PAGE no longer busy. */
+static void
+vm_page_release (struct page *page)
+{
+	lock_acquire (&vm_lock);
+	page->busy = false;
+	cond_broadcast (&page_idle, &vm_lock);
+	lock_release (&vm_lock);
+}
+
+/* Add PAGE, mapped in PML4, to the pages sharing FRAME. Must be called
+ * with vm_lock held. */
+static void
+frame_attach (struct frame *frame, struct page *page, uint64_t *pml4)
+{
+	list_push_back (&frame->rmap, &page->rmap_elem);
+	frame->page = page;
+	page->frame = frame;
+	page->pml4 = pml4;
+	if (frame->ref_cnt++ == 0 && vm_policy->frame_used != NULL)
+		vm_policy->frame_used (frame);
+}
+
+/* Remove PAGE from the pages sharing FRAME and return how many are left.
+ * Must be called with vm_lock held. */
+static size_t
+frame_detach (struct frame *frame, struct page *page)
+{
+	ASSERT (page->frame == frame && frame->ref_cnt > 0);
+
+	list_remove (&page->rmap_elem);
+	page->frame = NULL;
+	page->pml4 = NULL;
+	if (--frame->ref_cnt == 0)
+	{
+		if (vm_policy->frame_freed != NULL)
+			vm_policy->frame_freed (frame);
+		if (frame->text)
+		{
+			hash_delete (&text_cache, &frame->text_elem);
+			frame->text = false;
+		}
+		frame->page = NULL;
+	}
+	else if (frame->page == page)
+		frame->page = list_entry (list_front (&frame->rmap), struct page,
+				rmap_elem);
+	return frame->ref_cnt;
+}
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -130,6 +380,8 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 		else // VM_TYPE(type) == VM_FILE
 			uninit_new(page, upage, init, type, aux, file_backed_initializer);
 
+		page->writable = writable;
+
 		/* TODO: Insert the page into the spt. */
 		spt_insert_page (spt, page);
 		return true;
@@ -167,6 +419,52 @@ spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
 	return e != NULL ? hash_entry (e, struct page, elem) : NULL;
 }
 
+/* Find VA from SPT like spt_find_page(), but create its page from the
+ * area holding VA if it has none yet. SPT need not be the running
+ * process's. Stack pages are not created here, they are claimed as the
+ * stack grows. Return NULL if VA is in no area. */
+struct page *
+spt_get_page (struct supplemental_page_table *spt, void *va)
+{
+	struct page *page = spt_find_page (spt, va);
+	struct vma *vma;
+	struct temp *temp = NULL;
+	size_t ofs, read_bytes = 0;
+
+	if (page != NULL)
+		return page;
+	vma = vma_find (spt, va);
+	if (vma == NULL || vma == spt->stack)
+		return NULL;
+
+	if (vma->file != NULL)
+	{
+		ofs = (uint8_t *) va - vma->start;
+		if (vma->read_bytes > ofs)
+			read_bytes = vma->read_bytes - ofs < PGSIZE ? vma->read_bytes - ofs : PGSIZE;
+		temp = malloc (sizeof *temp);
+		if (temp == NULL)
+			return NULL;
+		temp->file = vma->file;
+		temp->page_read_bytes = read_bytes;
+		temp->writable = vma->writable;
+		temp->offset = vma->offset + ofs;
+	}
+	page = malloc (sizeof *page);
+	if (page == NULL)
+	{
+		free (temp);
+		return NULL;
+	}
+	// An area without a file is BSS, which needs no file access to load
+	uninit_new (page, va, temp != NULL ? lazy_load_segment : lazy_zero_segment,
+			vma->type, temp, VM_TYPE (vma->type) == VM_ANON
+			? anon_initializer : file_backed_initializer);
+	page->writable = vma->writable;
+	spt_insert_page (spt, page);
+	return page;
+}
+
 /* Insert PAGE into spt with validation. */
 bool
 spt_insert_page (struct supplemental_page_table *spt UNUSED,
@@ -191,72 +489,190 @@ spt_insert_page (struct supplemental_page_table *spt UNUSED,
 
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	vm_page_acquire (page);
 	hash_delete(&spt->hash_table, &page->elem);
-	vm_dealloc_page (page);
-	return true;
+	destroy (page);
+	vm_free_frame (page);
+	free (page);
+}
+/* Return the frame number of FRAME. */
+size_t
+vm_frame_index (struct frame *frame)
+{
+	return frame - frame_table;
+}
+
+/* Return frame number IDX. */
+struct frame *
+vm_frame_at (size_t idx)
+{
+	ASSERT (idx < frame_cnt);
+	return &frame_table[idx];
+}
+
+/* Store where the page held in FRAME is mapped in *PML4 and *VA. */
+void
+vm_frame_owner (struct frame *frame, uint64_t **pml4, void **va)
+{
+	*pml4 = frame->page->pml4;
+	*va = frame->page->va;
+}
+
+/* Return true if FRAME may be chosen for eviction. */
+bool
+vm_frame_evictable (struct frame *frame)
+{
+	struct page *page = frame->page;
+
+	if (page == NULL || frame->pinned || frame->pin_cnt > 0)
+		return false;
+	// Neither is one whose pages are being worked on
+	for (struct list_elem *e = list_begin (&frame->rmap);
+			e != list_end (&frame->rmap); e = list_next (e))
+		if (list_entry (e, struct page, rmap_elem)->busy)
+			return false;
+	// Stack is not a candidate for eviction
+	if (page->type == VM_MARKER_0)
+		return false;
+	// Neither is a page with nowhere to swap out to
+	return page->operations->swap_out != NULL;
+}
+
+/* Return true if any page sharing FRAME was accessed since the last call,
+ * and clear the access bits. Must be called with vm_lock held. */
+bool
+vm_frame_accessed (struct frame *frame)
+{
+	bool accessed = false;
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->rmap); e != list_end (&frame->rmap);
+			e = list_next (e))
+	{
+		struct page *p = list_entry (e, struct page, rmap_elem);
+		if (pml4_is_accessed (p->pml4, p->va))
+		{
+			pml4_set_accessed (p->pml4, p->va, false);
+			accessed = true;
+			if (p->prefaulted)
+			{
+				p->prefaulted = false;
+				fault_around_used++;
+			}
+		}
+	}
+	return accessed;
 }
+
+/* Settle the fault-around accounting of PAGE, which is about to lose
+ * its mapping: it was used if it has been accessed since it was
+ * populated. Must be called with vm_lock held. */
+static void
+vm_note_prefault (struct page *page)
+{
+	if (!page->prefaulted)
+		return;
+	if (pml4_is_accessed (page->pml4, page->va))
+		fault_around_used++;
+	page->prefaulted = false;
+}
+
 /* Get the struct frame, that will be evicted. */
 static struct frame *
 vm_get_victim (void) {
 	struct frame *victim = NULL;
-	struct thread *t;
-	struct list_elem *vm_frames_ptr = list_front(&vm_frames);
 	 /* TODO: The policy for eviction is up to you. */
 
 	/* Our Policy */
-	/* At the moment when we need victim, we search frames with the order they pushed 
-	   to the frame list. If the frame is not recently accessed, evict it. 
-	   If the frame is recently accessed, set the access bit false.
-	   Even though we searched whole items in the list but nothing evicted, 
-	   we can get victim in second search because we set the access bit false previously. */
-
-	size_t len = list_size(&vm_frames); 
-	for(int i = 0; ; i++)
-	{
-		// Behaves like circular linked list
-		if (vm_frames_ptr == NULL || vm_frames_ptr == list_back(&vm_frames))
-			vm_frames_ptr = list_front (&vm_frames);
-		else
-			vm_frames_ptr = list_next (vm_frames_ptr);
-		
-		victim = list_entry(vm_frames_ptr, struct frame, elem);
-		// Stack is not a candidate for eviction
-		if (victim->page->type == VM_MARKER_0)
-		{
-			continue;
-		}
-	
-		t = thread_get_by_id(victim->tid);
-	
-		// printf("VA 0x%lx ", victim->page->va);
-		if(pml4_is_accessed(t->pml4, victim->page->va))
-			pml4_set_accessed(t->pml4, victim->page->va, false);	// Set Access bit to false
-		else	// If the frame is not recently accessed, evict it
-			break;
-		
-		// Avoid possible infinite loop
-		if(i > len * 10)
-			PANIC("Eviction may have caused infinite loop");
+	/* Asked of the replacement policy in use, see vm/policy.c. The
+	   victim is returned pinned. */
+	lock_acquire (&vm_lock);
+	victim = vm_policy->get_victim ();
+	if (victim != NULL)
+	{
+		struct list_elem *e;
+
+		victim->pinned = true;
+		for (e = list_begin (&victim->rmap); e != list_end (&victim->rmap);
+				e = list_next (e))
+			list_entry (e, struct page, rmap_elem)->busy = true;
 	}
+	lock_release (&vm_lock);
 
 	return victim;
 }
 
-/* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+/* Make FRAME ready to be evicted as a 4KB page: a frame of an intact
+ * huge page has the huge page split first. Return false if that
+ * fails. Must be called with vm_lock held. */
+bool
+vm_frame_prepare_evict (struct frame *frame)
+{
+	return frame->huge == NULL || vm_split_huge (frame);
+}
+
+/* Break the intact huge page that FRAME belongs to into HPG_PAGE_CNT
+ * frames that are evicted independently. Must be called with vm_lock
+ * held. */
+static bool
+vm_split_huge (struct frame *frame) {
+	struct frame *head = frame->huge;
+
+	ASSERT (head != NULL);
+
+	if (!pml4_split_huge_page (frame->page->pml4, frame->page->va))
+		return false;
+
+	for (size_t i = 0; i < HPG_PAGE_CNT; i++)
+		head[i].huge = NULL;
+	return true;
+}
+
+/* Evict one page and return the corresponding frame, pinned and no
+ * longer attached to any page. A frame shared copy-on-write is written
+ * to swap once, and every page sharing it takes a reference to the
+ * same swap slot. Return NULL if no frame can be evicted. */
 static struct frame *
 vm_evict_frame (void) {
 	struct frame *victim UNUSED = vm_get_victim ();
-	struct thread *t = thread_get_by_id(victim->tid);
+	struct page *page;
+	struct list_elem *e;
 	/* TODO: swap out the victim and return the evicted frame. */
-	ASSERT(victim != NULL && t != NULL);
-	pml4_clear_page(t->pml4, victim->page->va);		// Remove the map between VA and KVA of the frame
+	if (victim == NULL)
+		return NULL;
+	page = victim->page;
+	ASSERT(page != NULL);
+
+	// Remove the map between VA and KVA in every process sharing the frame
+	lock_acquire (&vm_lock);
+	for (e = list_begin (&victim->rmap); e != list_end (&victim->rmap);
+			e = list_next (e))
+	{
+		struct page *p = list_entry (e, struct page, rmap_elem);
+		vm_note_prefault (p);
+		pml4_clear_page (p->pml4, p->va);
+	}
+	page = victim->page;
+	lock_release (&vm_lock);
 
 	// Call swap_out
 	lock_acquire(&swap_lock);
-	swap_out(victim->page);
+	swap_out(page);
 	lock_release(&swap_lock);
 
+	lock_acquire (&vm_lock);
+	while (!list_empty (&victim->rmap))
+	{
+		struct page *p = list_entry (list_front (&victim->rmap), struct page,
+				rmap_elem);
+		if (p != page)
+			anon_swap_share (p, page);
+		frame_detach (victim, p);
+		p->busy = false;
+	}
+	cond_broadcast (&page_idle, &vm_lock);
+	lock_release (&vm_lock);
+
 	return victim;
 }
 
@@ -264,7 +680,7 @@ vm_evict_frame (void) {
 /* palloc() and get frame. If there is no available page, evict the page
  * and return it. This always return valid address. That is, if the user pool
  * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * space. The frame is zeroed and returned pinned. */
 static struct frame *
 vm_get_frame (void) {
 	if(LOG)
@@ -272,138 +688,1093 @@ vm_get_frame (void) {
 		printf("vm_get_frame\n");
 	}
 	/* TODO: Fill this function. */
-	struct frame *frame = calloc(1, sizeof *frame);
-	
-	if(frame == NULL)
-	{
-		free(frame);
-		return NULL;
-	}
-	
-	uint8_t *kva = palloc_get_page (PAL_USER | PAL_ZERO);
+	struct frame *frame = vm_get_free_frame ();
 	
-	if (kva != NULL)
-	{
-		frame->kva = kva;
-		frame->tid = thread_current()->tid;
-		lock_acquire (&vm_lock);
-		list_push_back (&vm_frames, &frame->elem);
-		lock_release (&vm_lock);
-	}
-	else
+	if (frame == NULL)
 	{
-		free(frame);
 		frame = vm_evict_frame();
-		frame->tid = thread_current()->tid;
+		if (frame == NULL)
+			PANIC("Eviction may have caused infinite loop");
+		memset (frame->kva, 0, PGSIZE);
+		direct_reclaimed++;
 	}
 	ASSERT (frame != NULL);
 	return frame;
 }
 
-/* Growing the stack. */
-void
-vm_stack_growth (void *addr UNUSED) {
-	struct thread *t = thread_current();
-	if(vm_claim_page(pg_round_down(addr)))
+/* Wake kswapd if free user frames have fallen below the low
+ * watermark. */
+static void
+vm_wake_kswapd (void)
+{
+	if (vm_wmark_low == 0 || kswapd_awake)
+		return;
+	if (palloc_user_free_cnt () < vm_wmark_low)
 	{
-		struct page *page = spt_find_page(&t->spt, pg_round_down(addr));
-		page->type = VM_MARKER_0;
-		page->is_loaded = true;
-		return true;
+		kswapd_awake = true;
+		sema_up (&kswapd_sema);
 	}
-	return false;
 }
 
+/* Write back, ahead of eviction, the dirty file backed pages in the
+ * next KSWAPD_CLEAN_CNT frames of the frame table, so that evicting them
+ * later is a clean drop instead of a file write in the faulting thread.
+ * The page is kept busy meanwhile, so that it is not unmapped under us. */
+static void
+vm_clean_frames (void)
+{
+	size_t i;
 
-/* Return true on success */
-bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct thread *t = thread_current();
-	struct supplemental_page_table *spt UNUSED = &thread_current()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
-	/* Page fault is TRUE page fault */
-  	if (addr == NULL || !not_present || !is_user_vaddr(addr))
+	for (i = 0; i < KSWAPD_CLEAN_CNT && i < frame_cnt; i++)
 	{
-		// ASSERT(0);
-		exit(-1);
-	}
+		struct frame *frame = &frame_table[clean_hand];
+		struct page *page;
 
-	if(LOG)
-	{
-		printf("\nvm_try_handle_fault: Page fault in (%s)\n", thread_name());
-		printf("	Fault addr: 0x%lx\n", addr);
-		printf("	Fault page: 0x%lx\n", pg_round_down(addr));
-	}
+		clean_hand = (clean_hand + 1) % frame_cnt;
+		lock_acquire (&vm_lock);
+		page = frame->page;
+		if (!vm_frame_evictable (frame) || frame->huge != NULL
+				|| frame->ref_cnt != 1
+				|| VM_TYPE (page->operations->type) != VM_FILE
+				|| !pml4_is_dirty (page->pml4, page->va))
+		{
+			lock_release (&vm_lock);
+			continue;
+		}
+		/* A write that lands after this sets the bit again. */
+		pml4_set_dirty (page->pml4, page->va, false);
+		frame->pinned = true;
+		page->busy = true;
+		lock_release (&vm_lock);
 
-	page = spt_find_page(spt, pg_round_down(addr));
+		file_write_at (page->file.file, frame->kva, page->file.page_read_bytes,
+				page->file.offset);
+		frame->pinned = false;
+		vm_page_release (page);
+		kswapd_cleaned++;
+	}
+}
 
-	if(page == NULL)
+/* Reclaim daemon. Woken when free user frames fall below vm_wmark_low,
+ * it evicts pages until vm_wmark_high frames are free, then cleans the
+ * dirty file pages next in line for eviction, so that faults mostly
+ * find a free frame instead of evicting one themselves. */
+static void
+kswapd (void *aux UNUSED)
+{
+	for (;;)
 	{
-		if (addr < USER_STACK && addr > USER_STACK - (1 << 20))  // Stack size 1MB
+		sema_down (&kswapd_sema);
+		while (palloc_user_free_cnt () < vm_wmark_high)
 		{
-			if (f->rsp == addr + 8 || addr > f->rsp)
-			{
-				vm_stack_growth(pg_round_down(addr));
-				return true;
-			}
+			struct frame *frame = vm_evict_frame ();
+
+			if (frame == NULL)
+				break;
+			frame->pinned = false;
+			palloc_free_page (frame->kva);
+			kswapd_reclaimed++;
 		}
-		// ASSERT(0);
-		exit(-1);
+		vm_clean_frames ();
+		kswapd_awake = false;
 	}
-	
-	if(LOG)
+}
+
+/* Queue the pages in [START, END) of the address space SPT, with page
+ * table PML4, for the prefetch thread. Requests beyond
+ * PREFETCH_QUEUE_MAX are dropped, they are only hints. */
+void
+vm_prefetch_request (struct supplemental_page_table *spt, uint64_t *pml4,
+		void *start, void *end)
+{
+	struct prefetch_req *req;
+
+	if (start >= end)
+		return;
+	req = malloc (sizeof *req);
+	if (req == NULL)
+		return;
+	req->spt = spt;
+	req->pml4 = pml4;
+	req->start = start;
+	req->end = end;
+
+	lock_acquire (&prefetch_lock);
+	if (prefetch_queued < PREFETCH_QUEUE_MAX)
 	{
-		if(page != NULL)
-			printf("	Found fault page in spt\n");
-		else
-			printf("	Not found in spt\n");
+		list_push_back (&prefetch_queue, &req->elem);
+		prefetch_queued++;
+		req = NULL;
+		cond_signal (&prefetch_ready, &prefetch_lock);
 	}
+	lock_release (&prefetch_lock);
+	free (req);
+}
 
-	bool res = false;
-	
-	bool holdlock = lock_held_by_current_thread(&file_access);
-	if (!holdlock)
+/* Forget the requests for SPT, which is about to go away, and wait for
+ * the prefetch thread to be done with it. */
+static void
+vm_prefetch_cancel (struct supplemental_page_table *spt)
+{
+	struct list_elem *e, *next;
+
+	lock_acquire (&prefetch_lock);
+	for (e = list_begin (&prefetch_queue); e != list_end (&prefetch_queue);
+			e = next)
 	{
-		lock_acquire(&file_access);
+		struct prefetch_req *req = list_entry (e, struct prefetch_req, elem);
+
+		next = list_next (e);
+		if (req->spt == spt)
+		{
+			list_remove (e);
+			prefetch_queued--;
+			free (req);
+		}
 	}
-	res = vm_do_claim_page(page);
-	if (!holdlock)
+	while (prefetch_cur == spt)
+		cond_wait (&prefetch_done, &prefetch_lock);
+	lock_release (&prefetch_lock);
+}
+
+/* Load the pages of REQ that are not in memory into free frames, until
+ * free frames fall to the low watermark. Pages that read as zeros are
+ * left alone, they cost no I/O to fault in. */
+static void
+vm_prefetch (struct prefetch_req *req)
+{
+	struct supplemental_page_table *spt = req->spt;
+	uint8_t *va;
+
+	/* The owner holds it to fault, or to exit. Waiting for it could
+	 * deadlock with vm_prefetch_cancel(), and the hint is stale anyway. */
+	if (!lock_try_acquire (&spt->lock))
+		return;
+	for (va = req->start; va < req->end; va += PGSIZE)
 	{
-		lock_release(&file_access);
+		struct page *page = spt_get_page (spt, va);
+		struct frame *frame;
+		bool writable;
+
+		if (page == NULL || page->frame != NULL || page->pml4 != NULL
+				|| is_zero_anon_page (page, &writable))
+			continue;
+		if (palloc_user_free_cnt () <= vm_wmark_low)
+			break;
+		if (!vm_page_try_acquire (page))
+			continue;
+		frame = vm_get_free_frame ();
+		if (frame == NULL)
+		{
+			vm_page_release (page);
+			break;
+		}
+		if (vm_claim_frame (page, frame, req->pml4))
+		{
+			page->is_loaded = true;
+			prefetch_cnt++;
+		}
+		vm_page_release (page);
 	}
-	if(res)
-		page->is_loaded = true;
+	lock_release (&spt->lock);
+}
 
-	return res;
+/* Prefetch thread, see prefetch_queue. */
+static void
+prefetchd (void *aux UNUSED)
+{
+	for (;;)
+	{
+		struct prefetch_req *req;
+
+		lock_acquire (&prefetch_lock);
+		while (list_empty (&prefetch_queue))
+			cond_wait (&prefetch_ready, &prefetch_lock);
+		req = list_entry (list_pop_front (&prefetch_queue),
+				struct prefetch_req, elem);
+		prefetch_queued--;
+		prefetch_cur = req->spt;
+		lock_release (&prefetch_lock);
+
+		vm_prefetch (req);
+
+		lock_acquire (&prefetch_lock);
+		prefetch_cur = NULL;
+		cond_broadcast (&prefetch_done, &prefetch_lock);
+		lock_release (&prefetch_lock);
+		free (req);
+	}
 }
 
-/* Free the page.
- * DO NOT MODIFY THIS FUNCTION. */
-void
-vm_dealloc_page (struct page *page) {
-	destroy (page);
-	free (page);
+/* Tell the replacement policy that the page in FRAME will not be used
+ * again soon, so that it is evicted before the pages that may be. Must
+ * be called with vm_lock held. */
+static void
+vm_deactivate_frame (struct frame *frame)
+{
+	// Clear the access bits, so that no policy counts a last use
+	vm_frame_accessed (frame);
+	if (vm_policy->frame_deactivate != NULL)
+		vm_policy->frame_deactivate (frame);
+	deactivated_cnt++;
 }
 
-/* Claim the page that allocate on VA. */
-bool
-vm_claim_page (void *va UNUSED) {
-	if(LOG)
-	{
+/* Fault at VA in the MADV_SEQUENTIAL area VMA: have the next
+ * SEQUENTIAL_WINDOW pages read ahead, and mark the ones behind the last
+ * window, which a sequential reader is done with, for early eviction. */
+static void
+vm_sequential_fault (struct vma *vma, void *va)
+{
+	struct thread *t = thread_current ();
+	uint8_t *ahead = (uint8_t *) va + PGSIZE;
+	uint8_t *end = ahead + SEQUENTIAL_WINDOW * PGSIZE;
+	uint8_t *behind, *p;
+
+	if (end > vma->end || end < ahead)
+		end = vma->end;
+	vm_prefetch_request (&t->spt, t->pml4, ahead, end);
+
+	behind = (uint8_t *) va - (SEQUENTIAL_WINDOW + 1) * PGSIZE;
+	if ((uint8_t *) va - vma->start < (SEQUENTIAL_WINDOW + 1) * PGSIZE)
+		behind = vma->start;
+	lock_acquire (&vm_lock);
+	for (p = behind; p + PGSIZE < (uint8_t *) va; p += PGSIZE)
+	{
+		struct page *page = spt_find_page (&t->spt, p);
+
+		if (page != NULL && page->frame != NULL && page->frame->huge == NULL
+				&& page->frame->ref_cnt == 1)
+			vm_deactivate_frame (page->frame);
+	}
+	lock_release (&vm_lock);
+}
+
+/* Apply the madvise() hint ADVICE to the pages in [ADDR, ADDR + LENGTH),
+ * which must all belong to areas of the running process. RANDOM,
+ * SEQUENTIAL and NORMAL hold for every area the range touches, as a
+ * whole. Return 0 on success, -1 on a bad range or hint. */
+int
+do_madvise (void *addr, size_t length, int advice)
+{
+	struct thread *t = thread_current ();
+	struct supplemental_page_table *spt = &t->spt;
+	uint8_t *start = addr, *end, *va;
+	struct vma *vma;
+
+	if (pg_ofs (addr) != 0 || advice < MADV_NORMAL || advice > MADV_DONTNEED)
+		return -1;
+	if (length == 0)
+		return 0;
+	end = start + ROUND_UP (length, PGSIZE);
+	if (end <= start || !is_user_vaddr (end - 1))
+		return -1;
+
+	bool holdlock = lock_held_by_current_thread (&spt->lock);
+	if (!holdlock)
+		lock_acquire (&spt->lock);
+	for (va = start; va < end; va = vma->end)
+		if ((vma = vma_find (spt, va)) == NULL)
+		{
+			if (!holdlock)
+				lock_release (&spt->lock);
+			return -1;
+		}
+
+	switch (advice)
+	{
+		case MADV_NORMAL:
+		case MADV_RANDOM:
+		case MADV_SEQUENTIAL:
+			for (va = start; va < end; va = vma->end)
+			{
+				vma = vma_find (spt, va);
+				vma->advice = advice;
+			}
+			break;
+		case MADV_WILLNEED:
+			vm_prefetch_request (spt, t->pml4, start, end);
+			break;
+		case MADV_DONTNEED:
+			/* The areas stay: the pages come back zeroed, or read
+			 * from the executable, on their next fault. Stack pages
+			 * are only created as the stack grows, so they are kept. */
+			for (va = start; va < end; va += PGSIZE)
+			{
+				struct page *page = spt_find_page (spt, va);
+				bool split = true;
+
+				if (page == NULL || page_get_type (page) != VM_ANON
+						|| vma_find (spt, va) == spt->stack)
+					continue;
+				// A huge page is only freed whole; give this page its own PTE
+				if (page->frame != NULL)
+				{
+					lock_acquire (&vm_lock);
+					split = page->frame->huge == NULL
+							|| vm_split_huge (page->frame);
+					lock_release (&vm_lock);
+				}
+				if (split)
+				{
+					spt_remove_page (spt, page);
+					dontneed_cnt++;
+				}
+			}
+			break;
+	}
+	if (!holdlock)
+		lock_release (&spt->lock);
+	return 0;
+}
+
+/* Take a zeroed frame from the free user pool, returned pinned, without
+ * evicting anything. Return NULL if no frame is free. */
+static struct frame *
+vm_get_free_frame (void)
+{
+	struct frame *frame;
+	uint8_t *kva = palloc_get_page (PAL_USER | PAL_ZERO);
+
+	vm_wake_kswapd ();
+	if (kva == NULL)
+		return NULL;
+	frame = vm_frame_of (kva);
+	frame->pinned = true;
+	frame->huge = NULL;	// May be left over from a freed huge page
+	return frame;
+}
+
+/* Release the frame holding PAGE, if any: unmap it and, once no other
+ * page shares it, return its memory to the user pool. Frames of an
+ * intact huge page stay mapped, since pml4_destroy() frees the whole 2MB
+ * at once. A mapping of the zero page is removed, so that
+ * pml4_destroy() does not free it. */
+static void
+vm_free_frame (struct page *page)
+{
+	struct frame *frame = page->frame;
+	uint64_t *pml4 = page->pml4;
+
+	if (frame == NULL)
+	{
+		if (pml4 != NULL)
+		{
+			pml4_clear_page (pml4, page->va);
+			page->pml4 = NULL;
+		}
+		return;
+	}
+
+	lock_acquire (&vm_lock);
+	if (frame->huge == NULL)
+	{
+		vm_note_prefault (page);
+		pml4_clear_page (pml4, page->va);
+		if (frame_detach (frame, page) == 0)
+			palloc_free_page (frame->kva);
+	}
+	else
+		frame_detach (frame, page);
+	lock_release (&vm_lock);
+}
+
+/* Growing the stack. */
+void
+vm_stack_growth (void *addr UNUSED) {
+	struct thread *t = thread_current();
+	// The stack area takes the pages down to ADDR, unless a mapping is there
+	if (t->spt.stack == NULL
+			|| !vma_grow_down(&t->spt, t->spt.stack, pg_round_down(addr)))
+		return;
+	if(vm_claim_page(pg_round_down(addr)))
+	{
+		struct page *page = spt_find_page(&t->spt, pg_round_down(addr));
+		page->type = VM_MARKER_0;
+		page->is_loaded = true;
+		return true;
+	}
+	return false;
+}
+
+
+/* Return true if PAGE is an untouched anonymous page whose contents are
+ * all zeros, such as a page of a big BSS segment, and store whether it
+ * is writable in WRITABLE. */
+static bool
+is_zero_anon_page (struct page *page, bool *writable)
+{
+	if (page == NULL || page->operations->type != VM_UNINIT
+			|| VM_TYPE (page->uninit.type) != VM_ANON)
+		return false;
+
+	if (page->uninit.init == NULL)
+	{
+		*writable = true;
+		return true;
+	}
+	if (page->uninit.init == lazy_zero_segment)
+	{
+		*writable = page->writable;
+		return true;
+	}
+	if (page->uninit.init == lazy_load_segment)
+	{
+		struct temp *temp = page->uninit.aux;
+		*writable = temp->writable;
+		return temp->page_read_bytes == 0;
+	}
+	return false;
+}
+
+/* Back the whole 2MB aligned region around PAGE with a single huge page.
+ * This only happens when the region lies in one zero-filled anonymous
+ * area and every page of it faulted in so far is still untouched. Return
+ * false, leaving the region as it was, if the region does not qualify or
+ * if no aligned 2MB of physical memory is free; the caller then falls
+ * back to a normal 4KB page, and the area remembers the region so that
+ * the next faults in it give up at once. */
+static bool
+vm_try_claim_huge (struct page *page)
+{
+	struct thread *t = thread_current ();
+	struct supplemental_page_table *spt = &t->spt;
+	uint8_t *base = hpg_round_down (page->va);
+	struct vma *vma = vma_find (spt, page->va);
+	uint64_t created[HPG_PAGE_CNT / 64] = { 0 };
+	uint8_t *kva;
+	bool w;
+	size_t i;
+
+	// The area bounds and permission decide first, without a page lookup
+	if (vma == NULL || vma == spt->stack || VM_TYPE (vma->type) != VM_ANON
+			|| base < vma->start || base + HPGSIZE > vma->end
+			|| (vma->file != NULL
+				&& vma->read_bytes > (size_t) (base - vma->start))
+			|| vma->huge_skip == base)
+		return false;
+	for (i = 0; i < HPG_PAGE_CNT; i++)
+	{
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+		if (p != NULL && (!is_zero_anon_page (p, &w) || w != vma->writable))
+			goto unfit;
+	}
+	kva = palloc_get_huge_page (PAL_USER | PAL_ZERO);
+	if (kva == NULL)
+		goto unfit;
+
+	// Only now create the pages of the region not faulted in yet
+	for (i = 0; i < HPG_PAGE_CNT; i++)
+		if (spt_find_page (spt, base + i * PGSIZE) == NULL)
+		{
+			if (spt_get_page (spt, base + i * PGSIZE) == NULL)
+				goto undo;
+			created[i / 64] |= 1ULL << (i % 64);
+		}
+	/* Pages only read so far map the zero page, which would keep the
+	 * page table from being replaced. */
+	for (i = 0; i < HPG_PAGE_CNT; i++)
+		vm_free_frame (spt_find_page (spt, base + i * PGSIZE));
+	if (!pml4_set_huge_page (t->pml4, base, kva, vma->writable))
+		goto undo;
+	struct frame *frames = vm_frame_of (kva);
+
+	/* Transmute every page into an anon page backed by its slice. */
+	for (i = 0; i < HPG_PAGE_CNT; i++)
+	{
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+		struct frame *frame = &frames[i];
+		void *aux = p->uninit.aux;
+
+		lock_acquire (&vm_lock);
+		frame_attach (frame, p, t->pml4);
+		frame->huge = frames;
+		lock_release (&vm_lock);
+
+		p->uninit.page_initializer (p, p->uninit.type, frame->kva);
+		p->anon.writable = vma->writable;
+		p->is_swapped = false;
+		p->is_loaded = true;
+		free (aux);
+	}
+	return true;
+
+undo:
+	for (i = 0; i < HPG_PAGE_CNT; i++)
+		if (created[i / 64] & (1ULL << (i % 64)))
+			spt_remove_page (spt, spt_find_page (spt, base + i * PGSIZE));
+	palloc_free_multiple (kva, HPG_PAGE_CNT);
+unfit:
+	vma->huge_skip = base;
+	return false;
+}
+
+/* Map the shared zero page read-only at PAGE, if PAGE is an untouched
+ * zero-filled anonymous page. PAGE stays uninitialized until its first
+ * write. */
+static bool
+vm_map_zero_page (struct page *page)
+{
+	struct thread *t = thread_current ();
+	bool writable;
+
+	if (!is_zero_anon_page (page, &writable))
+		return false;
+	if (!pml4_set_page (t->pml4, page->va, zero_page, false))
+		return false;
+	page->pml4 = t->pml4;
+	return true;
+}
+
+/* Resolve a write fault on PAGE, which is mapped read-only because it
+ * maps the zero page or shares its frame with another process since
+ * fork(). A zero page mapping is replaced by a frame of its own. The last
+ * page left on a frame simply gets write access back; otherwise PAGE gets
+ * a private copy of the frame. Return false if PAGE may not be written at
+ * all. */
+static bool
+vm_handle_wp (struct page *page)
+{
+	struct thread *t = thread_current ();
+	struct frame *old = page->frame, *new;
+
+	if (!page->writable)
+		return false;
+	if (old == NULL)
+	{
+		if (page->pml4 == NULL)
+			return false;
+		vm_free_frame (page);	// Drop the zero page mapping
+		if (!vm_try_claim_huge (page) && !vm_do_claim_page (page))
+			return false;
+		page->is_loaded = true;
+		return true;
+	}
+
+	lock_acquire (&vm_lock);
+	if (old->ref_cnt == 1)
+	{
+		pml4_set_writable (t->pml4, page->va, true);
+		lock_release (&vm_lock);
+		return true;
+	}
+	old->pinned = true;	// Keep it from being evicted while we copy it
+	lock_release (&vm_lock);
+
+	new = vm_get_frame ();
+	memcpy (new->kva, old->kva, PGSIZE);
+
+	lock_acquire (&vm_lock);
+	pml4_clear_page (t->pml4, page->va);
+	// The other sharers may have exited while we were copying
+	if (frame_detach (old, page) == 0)
+		palloc_free_page (old->kva);
+	old->pinned = false;
+	frame_attach (new, page, t->pml4);
+	lock_release (&vm_lock);
+
+	bool res = pml4_set_page (t->pml4, page->va, new->kva, true);
+	new->pinned = false;
+	return res;
+}
+
+/* Return the loading information of PAGE if it is a not yet loaded page
+ * of an ELF segment, or of a file mapping when fault-around is on for
+ * those, or NULL. */
+static struct temp *
+fault_around_aux (struct page *page)
+{
+	if (page == NULL || page->operations->type != VM_UNINIT
+			|| page->uninit.init != lazy_load_segment || page->pml4 != NULL)
+		return NULL;
+	if (VM_TYPE (page->uninit.type) == VM_FILE && !fault_around_mmap)
+		return NULL;
+	return page->uninit.aux;
+}
+
+/* Fault-around: after the fault on the page at VA, loaded as described
+ * by FAULT, populate up to fault_around_pages of the pages that follow it
+ * in the same ELF segment or file mapping. A page qualifies only if it
+ * continues the file where the previous one ended and its data is in the
+ * buffer cache, and only while a frame is free, so that this costs
+ * neither disk I/O nor eviction. Stops at the first page that does not
+ * qualify, or that is busy. Must be called with the spt lock held. */
+static void
+vm_fault_around (void *va, enum vm_type type, const struct temp *fault)
+{
+	struct thread *t = thread_current ();
+	struct inode *inode = get_inode_from_file (fault->file);
+	off_t next = fault->offset + fault->page_read_bytes;
+	struct text_key key;
+	size_t i;
+
+	if (fault->page_read_bytes < PGSIZE)	// End of the segment
+		return;
+
+	for (i = 1; i <= fault_around_pages; i++)
+	{
+		struct page *p = spt_get_page (&t->spt, (uint8_t *) va + i * PGSIZE);
+		struct temp *temp = fault_around_aux (p);
+		struct frame *frame;
+
+		if (temp == NULL || VM_TYPE (p->uninit.type) != type
+				|| temp->page_read_bytes == 0 || temp->offset != next
+				|| get_inode_from_file (temp->file) != inode
+				|| !inode_is_cached (inode, temp->offset, temp->page_read_bytes))
+			break;
+		next += temp->page_read_bytes;
+		bool last = temp->page_read_bytes < PGSIZE;
+
+		if (!vm_page_try_acquire (p))
+			break;
+		frame = vm_get_free_frame ();
+		if (frame == NULL)
+		{
+			vm_page_release (p);
+			break;
+		}
+		bool text = vm_text_key (p, &key);
+		if (!vm_claim_frame (p, frame, t->pml4))
+		{
+			vm_page_release (p);
+			break;
+		}
+		if (text)
+			vm_publish_text (p, &key);
+		p->is_loaded = true;
+		p->prefaulted = true;
+		vm_page_release (p);
+		fault_around_cnt++;
+		if (last)
+			break;
+	}
+}
+
+/* Fill in KEY, the text cache key of PAGE, and return true if PAGE is a
+ * read-only executable page that is not loaded: one not touched yet, or
+ * one dropped on eviction. */
+static bool
+vm_text_key (struct page *page, struct text_key *key)
+{
+	struct file *file;
+
+	if (page->frame != NULL || page->pml4 != NULL)
+		return false;
+	if (page->operations->type == VM_UNINIT)
+	{
+		struct temp *temp = page->uninit.aux;
+
+		if (VM_TYPE (page->uninit.type) != VM_ANON
+				|| page->uninit.init != lazy_load_segment || temp == NULL
+				|| temp->writable || temp->page_read_bytes == 0)
+			return false;
+		file = temp->file;
+		key->ofs = temp->offset;
+		key->bytes = temp->page_read_bytes;
+	}
+	else if (page->operations->type == VM_ANON
+			&& page->operations->swap_out != NULL && page->anon.file != NULL
+			&& page->anon.swap_loc == (disk_sector_t) -1)
+	{
+		file = page->anon.file;
+		key->ofs = page->anon.offset;
+		key->bytes = page->anon.page_read_bytes;
+	}
+	else
+		return false;
+	key->inode = inode_get_inumber (get_inode_from_file (file));
+	return true;
+}
+
+/* Map the frame of the text cache that holds the page under KEY at
+ * PAGE, read-only, and return true. Return false if no such frame is
+ * cached, or if it is on its way out. */
+static bool
+vm_share_text (struct page *page, const struct text_key *key)
+{
+	struct thread *t = thread_current ();
+	struct frame lookup, *frame;
+	struct hash_elem *e;
+	bool res = false;
+
+	lookup.text_key = *key;
+	lock_acquire (&vm_lock);
+	e = hash_find (&text_cache, &lookup.text_elem);
+	if (e == NULL)
+		goto done;
+	frame = hash_entry (e, struct frame, text_elem);
+	// A pinned frame may be under eviction, with its sharers unmapped
+	if (frame->pinned || frame->huge != NULL)
+		goto done;
+
+	if (page->operations->type == VM_UNINIT)
+	{
+		struct temp *temp = page->uninit.aux;
+
+		page->uninit.page_initializer (page, page->uninit.type, frame->kva);
+		page->anon.page_read_bytes = temp->page_read_bytes;
+		page->anon.writable = false;
+		page->anon.offset = temp->offset;
+		page->anon.file = temp->file;
+		free (temp);
+	}
+	if (!pml4_set_page (t->pml4, page->va, frame->kva, false))
+		goto done;
+	frame_attach (frame, page, t->pml4);
+	page->is_loaded = true;
+	text_shared++;
+	res = true;
+done:
+	lock_release (&vm_lock);
+	return res;
+}
+
+/* Enter the frame of PAGE, just loaded, into the text cache under KEY. */
+static void
+vm_publish_text (struct page *page, const struct text_key *key)
+{
+	struct frame *frame = page->frame;
+
+	lock_acquire (&vm_lock);
+	if (frame != NULL && frame->huge == NULL && !frame->text)
+	{
+		frame->text_key = *key;
+		if (hash_insert (&text_cache, &frame->text_elem) == NULL)
+		{
+			frame->text = true;
+			text_loaded++;
+		}
+	}
+	lock_release (&vm_lock);
+}
+
+/* Print page fault, fault-around and reclaim statistics. */
+void
+vm_print_stats (void)
+{
+	printf ("Faults: %lld page faults, %s replacement\n",
+			fault_cnt, vm_policy->name);
+	printf ("Text: %lld executable pages loaded, %lld faults shared them\n",
+			text_loaded, text_shared);
+	printf ("Fault-around: %lld pages prefaulted, %lld used\n",
+			fault_around_cnt, fault_around_used);
+	printf ("Madvise: %lld pages prefetched, %lld deactivated, %lld dropped\n",
+			prefetch_cnt, deactivated_cnt, dontneed_cnt);
+	printf ("Reclaim: kswapd %lld pages freed, %lld cleaned; %lld direct\n",
+			kswapd_reclaimed, kswapd_cleaned, direct_reclaimed);
+}
+
+/* Give up on the fault at F. If it was met by a user copy routine on a
+ * bad pointer passed to a system call, page_fault() resumes the routine
+ * at its fixup so that the call fails; otherwise the process dies. */
+static bool
+vm_bad_fault (struct intr_frame *f, bool user)
+{
+	if (!user && exception_fixup_of (f->rip) != 0)
+		return false;
+	exit(-1);
+	NOT_REACHED ();
+}
+
+/* Return true if ADDR, which has no page in SPT, is a stack access by a
+ * process whose stack pointer is RSP, after claiming its page. ADDR is
+ * either in a page of the stack area not touched yet, or in no area and
+ * below the stack, which then grows down to it. */
+static bool
+vm_stack_access (struct supplemental_page_table *spt, void *addr, void *rsp)
+{
+	struct vma *vma = vma_find(spt, pg_round_down(addr));
+
+	if (vma != NULL && vma != spt->stack)
+		return false;
+	if (vma == NULL)
+	{
+		if (addr >= USER_STACK || addr <= USER_STACK - (1 << 20))  // Stack size 1MB
+			return false;
+		if (rsp != addr + 8 && addr <= rsp)
+			return false;
+	}
+	vm_stack_growth(pg_round_down(addr));
+	return spt_find_page(spt, pg_round_down(addr)) != NULL;
+}
+
+/* Return true on success */
+bool
+vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
+		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
+	struct thread *t = thread_current();
+	struct supplemental_page_table *spt UNUSED = &thread_current()->spt;
+	struct page *page = NULL;
+	/* TODO: Validate the fault */
+	/* TODO: Your code goes here */
+	/* Page fault is TRUE page fault */
+  	if (addr == NULL || !is_user_vaddr(addr))
+	{
+		// ASSERT(0);
+		return vm_bad_fault(f, user);
+	}
+	fault_cnt++;
+
+	/* Write to a present, read-only page: copy-on-write after fork() */
+	if (!not_present)
+	{
+		bool holdlock = lock_held_by_current_thread(&spt->lock);
+		if (!holdlock)
+			lock_acquire(&spt->lock);
+		page = spt_find_page(spt, pg_round_down(addr));
+		bool res = false;
+		if (write && page != NULL)
+		{
+			vm_page_acquire(page);
+			res = vm_handle_wp(page);
+			vm_page_release(page);
+		}
+		if (!holdlock)
+			lock_release(&spt->lock);
+		if (res)
+			return true;
+		return vm_bad_fault(f, user);
+	}
+
+	if(LOG)
+	{
+		printf("\nvm_try_handle_fault: Page fault in (%s)\n", thread_name());
+		printf("	Fault addr: 0x%lx\n", addr);
+		printf("	Fault page: 0x%lx\n", pg_round_down(addr));
+	}
+
+	bool res = false;
+	
+	// The prefetch thread may be adding pages to the spt
+	bool holdlock = lock_held_by_current_thread(&spt->lock);
+	if (!holdlock)
+	{
+		lock_acquire(&spt->lock);
+	}
+
+	page = spt_get_page(spt, pg_round_down(addr));
+	struct vma *vma = vma_find(spt, pg_round_down(addr));
+
+	if(page == NULL)
+	{
+		// In a system call, F holds the kernel's stack pointer
+		void *rsp = user ? (void *) f->rsp : t->user_rsp;
+		if (vma == NULL || vma == spt->stack)
+			res = vm_stack_access(spt, addr, rsp);
+		if (!holdlock)
+			lock_release(&spt->lock);
+		if (res)
+			return true;
+		// ASSERT(0);
+		return vm_bad_fault(f, user);
+	}
+	
+	if(LOG)
+	{
+		if(page != NULL)
+			printf("	Found fault page in spt\n");
+		else
+			printf("	Not found in spt\n");
+	}
+	vm_trace_fault(spt, vma, page->va);
+
+	// Wait for the eviction or write back of this page to finish
+	vm_page_acquire(page);
+	// The prefetch thread may have loaded it while we waited
+	if (page->frame != NULL)
+	{
+		vm_page_release(page);
+		if (!holdlock)
+			lock_release(&spt->lock);
+		return true;
+	}
+	// Reading untouched zeros needs no frame of its own
+	if (!write && vm_map_zero_page(page))
+	{
+		vm_page_release(page);
+		if (!holdlock)
+			lock_release(&spt->lock);
+		return true;
+	}
+	// Another process may have this page of the same program loaded
+	struct text_key key;
+	bool text = vm_text_key(page, &key);
+	if (text && vm_share_text(page, &key))
+	{
+		vm_page_release(page);
+		if (!holdlock)
+			lock_release(&spt->lock);
+		return true;
+	}
+
+	// Keep what fault-around needs, claiming the page overwrites it.
+	// madvise() hints replace it with readahead, or turn it off.
+	int advice = vma != NULL ? vma->advice : MADV_NORMAL;
+	struct temp *around = fault_around_pages > 0 && advice == MADV_NORMAL
+			? fault_around_aux(page) : NULL;
+	struct temp fault;
+	enum vm_type type = VM_TYPE(page->uninit.type);
+	if (around != NULL)
+		fault = *around;
+
+	res = vm_try_claim_huge(page) || vm_do_claim_page(page);
+	if(res)
+		page->is_loaded = true;
+	if (res && text)
+		vm_publish_text(page, &key);
+	vm_page_release(page);
+	if (res && around != NULL)
+		vm_fault_around(page->va, type, &fault);
+	if (res && advice == MADV_SEQUENTIAL)
+		vm_sequential_fault(vma, page->va);
+	if (!holdlock)
+	{
+		lock_release(&spt->lock);
+	}
+
+	return res;
+}
+
+/* Bring in the page of the running process holding ADDR, if needed, and
+ * pin its frame. With WRITE, also make it writable. A read-only mapping
+ * of the zero page is left as it is: there is nothing to evict. Must be
+ * called with the spt lock held. */
+static bool
+vm_pin_page (struct supplemental_page_table *spt, void *addr, bool write)
+{
+	void *va = pg_round_down (addr);
+	struct page *page = spt_get_page (spt, va);
+	bool res = true;
+
+	if (page == NULL
+			&& vm_stack_access (spt, addr, thread_current ()->user_rsp))
+		page = spt_find_page (spt, va);
+	if (page == NULL || (write && !page->writable))
+		return false;
+	vm_page_acquire (page);
+	if (page->frame == NULL && (write || page->pml4 == NULL))
+	{
+		vm_free_frame (page);	// Drop the zero page mapping, if any
+		res = vm_try_claim_huge (page) || vm_do_claim_page (page);
+		if (res)
+			page->is_loaded = true;
+	}
+	else if (write && page->frame != NULL)
+		res = vm_handle_wp (page);
+	if (res && page->frame != NULL)
+	{
+		lock_acquire (&vm_lock);
+		page->frame->pin_cnt++;
+		lock_release (&vm_lock);
+	}
+	vm_page_release (page);
+	return res;
+}
+
+/* Undo vm_pin_page() on the page at VA. */
+static void
+vm_unpin_page (struct supplemental_page_table *spt, void *va)
+{
+	struct page *page = spt_find_page (spt, va);
+
+	if (page == NULL || page->frame == NULL)
+		return;
+	lock_acquire (&vm_lock);
+	ASSERT (page->frame->pin_cnt > 0);
+	page->frame->pin_cnt--;
+	lock_release (&vm_lock);
+}
+
+/* Fault in and pin every page of the user buffer [BUFFER, BUFFER + SIZE)
+ * of the running process, so that read() and write() copy between the
+ * buffer cache and its frames without faulting while they hold
+ * file_access, and without the frames being evicted under them. With
+ * WRITE, the pages are also made writable, copying them if they are
+ * shared copy-on-write. Return false, with nothing pinned, if any page of
+ * the buffer is not a valid one. */
+bool
+vm_pin_buffer (const void *buffer, size_t size, bool write)
+{
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *start = pg_round_down (buffer);
+	uint8_t *end = (uint8_t *) buffer + size;
+	uint8_t *va;
+	bool res = true;
+
+	if (size == 0)
+		return true;
+	if (end < start || !is_user_vaddr (end - 1))
+		return false;
+
+	bool holdlock = lock_held_by_current_thread (&spt->lock);
+	if (!holdlock)
+		lock_acquire (&spt->lock);
+	for (va = start; va < end; va += PGSIZE)
+		if (!vm_pin_page (spt, va == start ? (void *) buffer : va, write))
+		{
+			res = false;
+			break;
+		}
+	if (!res)
+		while (va > start)
+		{
+			va -= PGSIZE;
+			vm_unpin_page (spt, va);
+		}
+	if (!holdlock)
+		lock_release (&spt->lock);
+	return res;
+}
+
+/* Unpin the pages pinned by vm_pin_buffer (BUFFER, SIZE, ...). */
+void
+vm_unpin_buffer (const void *buffer, size_t size)
+{
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *end = (uint8_t *) buffer + size;
+
+	if (size == 0)
+		return;
+	bool holdlock = lock_held_by_current_thread (&spt->lock);
+	if (!holdlock)
+		lock_acquire (&spt->lock);
+	for (uint8_t *va = pg_round_down (buffer); va < end; va += PGSIZE)
+		vm_unpin_page (spt, va);
+	if (!holdlock)
+		lock_release (&spt->lock);
+}
+
+/* Free the page.
+ * DO NOT MODIFY THIS FUNCTION. */
+void
+vm_dealloc_page (struct page *page) {
+	destroy (page);
+	free (page);
+}
+
+/* Claim the page that allocate on VA. */
+bool
+vm_claim_page (void *va UNUSED) {
+	if(LOG)
+	{
 		printf("vm_claim_page on va: 0x%lx\n", va);
 	}
 	struct page *page = (struct page *)malloc(sizeof(struct page));
 	ASSERT(page != NULL);
 	/* TODO: Fill this function */
 	page->va = va;
+	page->frame = NULL;
+	page->writable = true;
+	page->prefaulted = false;
+	page->busy = false;
 	page->operations = &page_op;	// When page calls swap_in, it goes to add_map
+	struct lock *spt_lock = &thread_current()->spt.lock;
+	bool holdlock = lock_held_by_current_thread(spt_lock);
+	if (!holdlock)
+		lock_acquire(spt_lock);
 	spt_insert_page (&thread_current()->spt, page);
-	lock_acquire(&file_access);
 	bool ret = vm_do_claim_page (page);
-	lock_release(&file_access);
+	if (!holdlock)
+		lock_release(spt_lock);
 	return ret;
 }
 
@@ -412,65 +1783,135 @@ static bool
 vm_do_claim_page (struct page *page) {
 	if(LOG)
 		printf("vm_do_claim_page\n");
-	struct frame* frame = vm_get_frame();
-	if (frame == NULL)
-	{
-		/* Free page in vm_claim_page */
-		free(page);
-		return false;
-	}
 	if (page == NULL) 
 		return false;
-	
+	return vm_claim_frame (page, vm_get_frame (), thread_current ()->pml4);
+}
+
+/* Load PAGE into FRAME, which is pinned and attached to no page, and map
+ * it in PML4. FRAME is unpinned, and freed if the load fails. */
+static bool
+vm_claim_frame (struct page *page, struct frame *frame, uint64_t *pml4) {
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	lock_acquire (&vm_lock);
+	frame_attach (frame, page, pml4);
+	lock_release (&vm_lock);
 	/* TODO: Insert page table entry to map page's VA to frame's PA. */
-	return swap_in (page, frame->kva);
+	bool res = swap_in (page, frame->kva);
+	frame->pinned = false;
+	if (!res)
+		vm_free_frame (page);
+	return res;
 }
 
 /* Initialize new supplemental page table */
 void
 supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
 	hash_init (&spt->hash_table, spt_hash, spt_less, NULL);
+	spt->vma_root = NULL;
+	spt->stack = NULL;
+	lock_init (&spt->lock);
+	spt->trace = NULL;
 	return;
 }
 
-static void copy_page (struct hash_elem *e, struct supplemental_page_table *dst)
+/* Map the frame of the resident PAGE read-only in both the parent and the
+ * child NEWPAGE, so that the first write by either one copies it. Return
+ * false if the frame cannot be shared. */
+static bool
+share_frame (struct page *page, struct page *newpage)
 {
-	lock_acquire(&copy_lock);
-	struct thread *t = thread_current();
-	struct page *page = hash_entry(e, struct page, elem);
-	struct page *newpage = (struct page *)malloc(sizeof(struct page));
+	struct thread *t = thread_current ();
+	struct frame *frame = page->frame;
+	bool res = false;
 
-	memcpy(newpage, page, sizeof(struct page));
+	lock_acquire (&vm_lock);
+	// Sharing works on 4KB mappings only
+	if (frame->huge != NULL && !vm_split_huge (frame))
+		goto done;
+	if (!pml4_set_page (t->pml4, newpage->va, frame->kva, false))
+		goto done;
+	/* The parent is waiting for us in fork(), and its stale TLB
+	 * entries go away when its page table is loaded again. */
+	pml4_set_writable (page->pml4, page->va, false);
+	frame_attach (frame, newpage, t->pml4);
+	res = true;
+done:
+	lock_release (&vm_lock);
+	return res;
+}
 
-	if (newpage == NULL) {
-		free(newpage);
-		PANIC("not enough memory");
-	}
-	ASSERT(page != NULL);
+/* Copy PAGE of the parent into the child's spt DST. Anonymous memory is
+ * not copied: untouched pages are left to the child's own areas, swapped
+ * out pages share the swap slot and resident pages share the frame
+ * copy-on-write. File backed pages are copied right away. */
+static bool
+copy_page (struct page *page, struct supplemental_page_table *dst)
+{
+	struct page *newpage;
+	bool res;
+
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return true;
+	newpage = (struct page *)malloc(sizeof(struct page));
+	if (newpage == NULL)
+		return false;
+	/* Keep kswapd off the parent page while we look at it */
+	vm_page_acquire(page);
+	res = copy_page_locked(page, newpage, dst);
+	vm_page_release(page);
+	return res;
+}
+
+static bool
+copy_page_locked (struct page *page, struct page *newpage,
+		struct supplemental_page_table *dst)
+{
+	memcpy(newpage, page, sizeof(struct page));
+	newpage->frame = NULL;
+	newpage->pml4 = NULL;
+	newpage->prefaulted = false;
+	newpage->busy = false;
 
 	/* Insert to child's spt */
-	/* Only allocate physical memory if loaded */
 	spt_insert_page(dst, newpage);
-	newpage->operations = &page_op;
-	lock_acquire(&file_access);
-	vm_do_claim_page(newpage);
-	lock_release(&file_access);
-	if(page->is_loaded)
+
+	switch (VM_TYPE (page->operations->type))
 	{
-		/* Copy physical memory */
-		memcpy(newpage->frame->kva, page->frame->kva, PGSIZE);
+		case VM_ANON:
+			/* A dropped executable page is read back through the
+			 * child's own handle of the executable. */
+			if (page->operations->swap_out != NULL && newpage->anon.file != NULL)
+				newpage->anon.file = thread_current ()->prog_file;
+			if (page->frame == NULL && page->operations->swap_out != NULL)
+			{
+				anon_swap_share (newpage, page);
+				return true;
+			}
+			if (page->frame == NULL)
+				break;
+			if (share_frame (page, newpage))
+				return true;
+			break;
+		default:
+			break;
 	}
-	lock_release(&copy_lock);
-	return;
+
+	/* Copy physical memory */
+	newpage->operations = &page_op;
+	if (!vm_do_claim_page(newpage))
+		return false;
+	if(page->is_loaded && page->frame != NULL)
+		memcpy(newpage->frame->kva, page->frame->kva, PGSIZE);
+	return true;
 }
 
 static void kill_page (struct hash_elem *e, void *aux)
 {
 	struct page *page = hash_entry(e, struct page, elem);
+	vm_page_acquire(page);
 	destroy(page);
+	vm_free_frame(page);
 	free(page);
 	return;
 }
@@ -481,17 +1922,25 @@ supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
       struct supplemental_page_table *src UNUSED) {
 	ASSERT(dst->hash_table.elem_cnt == 0);
 	size_t i;
+	bool success = true;
 	struct hash *h = &src->hash_table;
-	for (i = 0; i < h->bucket_cnt; i++) {
+
+	/* The parent waits in fork(), so only kswapd can touch its pages */
+	lock_acquire(&src->lock);
+	success = vma_copy(dst, src, thread_current()->prog_file);
+	for (i = 0; i < h->bucket_cnt && success; i++) {
 		struct list *bucket = &h->buckets[i];
 		struct list_elem *elem, *next;
 
-		for (elem = list_begin (bucket); elem != list_end (bucket); elem = next) {
+		for (elem = list_begin (bucket); elem != list_end (bucket) && success;
+				elem = next) {
 			next = list_next (elem);
-			copy_page (list_elem_to_hash_elem (elem), dst);
+			success = copy_page (hash_entry (list_elem_to_hash_elem (elem),
+						struct page, elem), dst);
 		}
 	}
-	return true;
+	lock_release(&src->lock);
+	return success;
 }
 
 /* Free the resource hold by the supplemental page table */
@@ -502,6 +1951,11 @@ supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
 	struct hash *h = &spt->hash_table;
 	struct list *buckets = h->buckets;
 	size_t i;
+	vm_prefetch_cancel(spt);
+	vm_trace_finish(spt);
+	bool holdlock = lock_held_by_current_thread(&spt->lock);
+	if (!holdlock)
+		lock_acquire(&spt->lock);
 	for (i = 0; i < h->bucket_cnt; i++) {
 		struct list *bucket = &h->buckets[i];
 		while (!list_empty (bucket)) {
@@ -512,5 +1966,15 @@ supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
 		list_init (bucket);
 	}
 	h->elem_cnt = 0;
+	vma_destroy(spt);
+	// No page is left to evict, so no ghost of this address space comes back
+	if (vm_policy->forget != NULL)
+	{
+		lock_acquire(&vm_lock);
+		vm_policy->forget(thread_current()->pml4);
+		lock_release(&vm_lock);
+	}
+	if (!holdlock)
+		lock_release(&spt->lock);
 	return;
 }
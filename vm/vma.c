@@ -0,0 +1,297 @@
+/* vma.c: Virtual memory areas of an address space. */
+
+#include "vm/vma.h"
+#include <debug.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+
+/* The areas of an address space are disjoint, so ordering them by their
+ * start also orders their ends, and a lookup by address is a plain
+ * search down an AVL tree. */
+
+static int
+vma_height (struct vma *v)
+{
+	return v != NULL ? v->height : 0;
+}
+
+static void
+vma_update (struct vma *v)
+{
+	int l = vma_height (v->left), r = vma_height (v->right);
+	v->height = (l > r ? l : r) + 1;
+}
+
+static struct vma *
+rotate_right (struct vma *v)
+{
+	struct vma *l = v->left;
+
+	v->left = l->right;
+	l->right = v;
+	vma_update (v);
+	vma_update (l);
+	return l;
+}
+
+static struct vma *
+rotate_left (struct vma *v)
+{
+	struct vma *r = v->right;
+
+	v->right = r->left;
+	r->left = v;
+	vma_update (v);
+	vma_update (r);
+	return r;
+}
+
+/* Restore the balance of V, whose subtrees are balanced and differ in
+ * height by at most 2, and return the new root of the subtree. */
+static struct vma *
+rebalance (struct vma *v)
+{
+	int balance;
+
+	vma_update (v);
+	balance = vma_height (v->left) - vma_height (v->right);
+	if (balance > 1)
+	{
+		if (vma_height (v->left->left) < vma_height (v->left->right))
+			v->left = rotate_left (v->left);
+		return rotate_right (v);
+	}
+	if (balance < -1)
+	{
+		if (vma_height (v->right->right) < vma_height (v->right->left))
+			v->right = rotate_right (v->right);
+		return rotate_left (v);
+	}
+	return v;
+}
+
+static struct vma *
+tree_insert (struct vma *root, struct vma *v)
+{
+	if (root == NULL)
+		return v;
+	if (v->start < root->start)
+		root->left = tree_insert (root->left, v);
+	else
+		root->right = tree_insert (root->right, v);
+	return rebalance (root);
+}
+
+/* Unlink the leftmost area of ROOT, store it in *MIN and return the new
+ * root of the subtree. */
+static struct vma *
+tree_remove_min (struct vma *root, struct vma **min)
+{
+	if (root->left == NULL)
+	{
+		*min = root;
+		return root->right;
+	}
+	root->left = tree_remove_min (root->left, min);
+	return rebalance (root);
+}
+
+static struct vma *
+tree_remove (struct vma *root, struct vma *v)
+{
+	ASSERT (root != NULL);
+	if (v->start < root->start)
+		root->left = tree_remove (root->left, v);
+	else if (v->start > root->start)
+		root->right = tree_remove (root->right, v);
+	else
+	{
+		struct vma *min;
+
+		if (root->right == NULL)
+			return root->left;
+		root->right = tree_remove_min (root->right, &min);
+		min->left = root->left;
+		min->right = root->right;
+		root = min;
+	}
+	return rebalance (root);
+}
+
+/* An area of mmap() owns the handle it reopened; an ELF segment only
+ * borrows the process's handle of its executable. */
+static void
+vma_free (struct vma *v)
+{
+	if (VM_TYPE (v->type) == VM_FILE)
+		file_close (v->file);
+	free (v);
+}
+
+/* Add the area [START, END) to the address space of SPT and return it.
+ * Its first READ_BYTES bytes come from FILE at OFFSET, if FILE is not
+ * NULL. Return NULL if the area overlaps another one or if memory runs
+ * out. */
+struct vma *
+vma_create (struct supplemental_page_table *spt, void *start, void *end,
+		enum vm_type type, bool writable, struct file *file, off_t offset,
+		size_t read_bytes)
+{
+	struct vma *v;
+
+	ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+	ASSERT ((uint8_t *) start < (uint8_t *) end);
+	if (vma_overlaps (spt, start, end))
+		return NULL;
+	v = malloc (sizeof *v);
+	if (v == NULL)
+		return NULL;
+	v->start = start;
+	v->end = end;
+	v->type = type;
+	v->writable = writable;
+	v->file = file;
+	v->offset = offset;
+	v->read_bytes = read_bytes;
+	v->advice = MADV_NORMAL;
+	v->huge_skip = NULL;
+	v->left = v->right = NULL;
+	v->height = 1;
+	spt->vma_root = tree_insert (spt->vma_root, v);
+	return v;
+}
+
+/* Return the area that holds VA, or NULL. */
+struct vma *
+vma_find (struct supplemental_page_table *spt, const void *va)
+{
+	struct vma *v = spt->vma_root;
+
+	while (v != NULL)
+	{
+		if ((const uint8_t *) va < v->start)
+			v = v->left;
+		else if ((const uint8_t *) va >= v->end)
+			v = v->right;
+		else
+			return v;
+	}
+	return NULL;
+}
+
+/* Return true if any area holds an address in [START, END). */
+bool
+vma_overlaps (struct supplemental_page_table *spt, const void *start,
+		const void *end)
+{
+	struct vma *v = spt->vma_root;
+
+	while (v != NULL)
+	{
+		if ((const uint8_t *) end <= v->start)
+			v = v->left;
+		else if ((const uint8_t *) start >= v->end)
+			v = v->right;
+		else
+			return true;
+	}
+	return false;
+}
+
+/* Extend VMA down to START, as the stack grows. Its key changes, but
+ * since the pages it takes were free, it keeps its place in the tree.
+ * Return false if another area is in the way. */
+bool
+vma_grow_down (struct supplemental_page_table *spt, struct vma *vma,
+		void *start)
+{
+	ASSERT (pg_ofs (start) == 0);
+	if ((uint8_t *) start >= vma->start)
+		return true;
+	if (vma_overlaps (spt, start, vma->start))
+		return false;
+	vma->start = start;
+	return true;
+}
+
+/* Remove VMA from the address space of SPT and free it. Its pages must
+ * have been removed already. */
+void
+vma_remove (struct supplemental_page_table *spt, struct vma *vma)
+{
+	spt->vma_root = tree_remove (spt->vma_root, vma);
+	if (spt->stack == vma)
+		spt->stack = NULL;
+	vma_free (vma);
+}
+
+/* Return a copy of the subtree ROOT of SRC for DST, or NULL with *OK set
+ * to false if memory runs out. */
+static struct vma *
+tree_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src, struct vma *root,
+		struct file *prog_file, bool *ok)
+{
+	struct vma *v;
+
+	if (root == NULL || !*ok)
+		return NULL;
+	v = malloc (sizeof *v);
+	if (v == NULL)
+	{
+		*ok = false;
+		return NULL;
+	}
+	*v = *root;
+	if (VM_TYPE (v->type) == VM_FILE)
+		v->file = file_reopen (root->file);
+	else if (v->file != NULL)
+		v->file = prog_file;
+	if (root->file != NULL && v->file == NULL)
+	{
+		free (v);
+		*ok = false;
+		return NULL;
+	}
+	if (src->stack == root)
+		dst->stack = v;
+	v->left = tree_copy (dst, src, root->left, prog_file, ok);
+	v->right = tree_copy (dst, src, root->right, prog_file, ok);
+	return v;
+}
+
+/* Give DST, which has no area yet, a copy of every area of SRC, for
+ * fork(). ELF segments of the copy read PROG_FILE, the child's handle of
+ * its executable. */
+bool
+vma_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src, struct file *prog_file)
+{
+	bool ok = true;
+
+	ASSERT (dst->vma_root == NULL);
+	dst->vma_root = tree_copy (dst, src, src->vma_root, prog_file, &ok);
+	if (!ok)
+		vma_destroy (dst);
+	return ok;
+}
+
+static void
+tree_destroy (struct vma *root)
+{
+	if (root == NULL)
+		return;
+	tree_destroy (root->left);
+	tree_destroy (root->right);
+	vma_free (root);
+}
+
+/* Free every area of SPT. */
+void
+vma_destroy (struct supplemental_page_table *spt)
+{
+	tree_destroy (spt->vma_root);
+	spt->vma_root = NULL;
+	spt->stack = NULL;
+}
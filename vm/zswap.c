@@ -0,0 +1,427 @@
+/* zswap.c: Compressed in-memory swap tier.
+ *
+ * Pages are compressed with a small LZF-style compressor and kept in
+ * a pool of user pages carved into ZCHUNK-byte chunks, each pool
+ * page tracking its chunks in a single 64-bit mask. Pages that do not
+ * compress to at most ZSWAP_MAX_LEN bytes go straight to the disk.
+ * When the pool is full, the oldest stored pages are written back to
+ * their swap slots to make room. The pool takes its pages from the
+ * user pool, which is the memory being reclaimed, so that swapping
+ * never runs the kernel short of pages for malloc(), page tables and
+ * thread stacks. */
+
+#include "vm/zswap.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+size_t zswap_max_pool_percent = 20;
+
+/* Pool pages are split into this many chunks of ZCHUNK bytes. */
+#define ZCHUNK_CNT 64
+#define ZCHUNK (PGSIZE / ZCHUNK_CNT)
+
+/* Pages compressing to more than this are not worth keeping. */
+#define ZSWAP_MAX_LEN (PGSIZE * 3 / 4)
+
+/* A page of the pool. */
+struct zpool_page {
+	uint8_t *kva;               /* NULL if not allocated */
+	uint64_t used;              /* Bit I set if chunk I is in use */
+};
+
+/* A page stored in the pool. */
+struct zswap_entry {
+	struct list_elem lru_elem;  /* Element in lru, oldest first */
+	disk_sector_t slot;         /* Swap slot the page belongs to */
+	size_t zpage;               /* Index in pool */
+	uint8_t chunk;              /* First chunk in the pool page */
+	uint8_t chunk_cnt;          /* Number of chunks */
+	uint16_t len;               /* Compressed size in bytes */
+};
+
+static struct lock zswap_lock;
+static struct disk *disk;
+static size_t sectors_per_slot;
+
+static struct zpool_page *pool;
+static size_t pool_max;         /* Capacity of pool, in pages */
+static size_t pool_cnt;         /* Pool pages allocated */
+
+static struct zswap_entry **slot_map;   /* Entry of each swap slot */
+static struct list lru;
+
+/* Statistics. */
+static long long stored_cnt, load_cnt, reject_cnt, writeback_cnt;
+static long long stored_bytes;          /* Compressed bytes in the pool */
+static long long stored_pages;          /* Pages in the pool */
+
+/* Scratch space, used under zswap_lock. */
+static uint8_t zbuf[ZSWAP_MAX_LEN];
+static uint8_t wb_page[PGSIZE];
+
+static void zswap_writeback (void);
+static size_t lzf_compress (const uint8_t *, size_t, uint8_t *, size_t);
+static size_t lzf_decompress (const uint8_t *, size_t, uint8_t *, size_t);
+
+/* Sets up zswap in front of SWAP_DISK, which holds SLOT_CNT slots of
+ * one page each. */
+void
+zswap_init (struct disk *swap_disk, size_t slot_cnt) {
+	size_t user_pages;
+
+	lock_init (&zswap_lock);
+	list_init (&lru);
+	disk = swap_disk;
+	sectors_per_slot = PGSIZE / DISK_SECTOR_SIZE;
+
+	if (zswap_max_pool_percent > 100)
+		zswap_max_pool_percent = 100;
+	palloc_user_pool (&user_pages);
+	pool_max = user_pages * zswap_max_pool_percent / 100;
+	if (pool_max == 0)
+		return;
+
+	pool = calloc (pool_max, sizeof *pool);
+	slot_map = calloc (slot_cnt, sizeof *slot_map);
+	if (pool == NULL || slot_map == NULL) {
+		free (pool);
+		free (slot_map);
+		pool_max = 0;
+	}
+}
+
+/* Finds CNT free chunks in a row in the pool, allocating a new pool
+ * page if needed, and marks them used. Stores their place in
+ * *ZPAGE and *CHUNK. Returns false if the pool is full. */
+static bool
+zpool_alloc (size_t cnt, size_t *zpage, uint8_t *chunk) {
+	uint64_t mask = cnt == ZCHUNK_CNT ? ~(uint64_t) 0 : ((uint64_t) 1 << cnt) - 1;
+	size_t free_idx = pool_max;
+	size_t i, shift;
+
+	for (i = 0; i < pool_max; i++) {
+		struct zpool_page *p = &pool[i];
+
+		if (p->kva == NULL) {
+			if (free_idx == pool_max)
+				free_idx = i;
+			continue;
+		}
+		for (shift = 0; shift + cnt <= ZCHUNK_CNT; shift++)
+			if ((p->used & (mask << shift)) == 0) {
+				p->used |= mask << shift;
+				*zpage = i;
+				*chunk = shift;
+				return true;
+			}
+	}
+
+	if (free_idx == pool_max)
+		return false;
+	pool[free_idx].kva = palloc_get_page (PAL_USER);
+	if (pool[free_idx].kva == NULL)
+		return false;
+	pool_cnt++;
+	pool[free_idx].used = mask;
+	*zpage = free_idx;
+	*chunk = 0;
+	return true;
+}
+
+/* Frees the chunks of E, and the pool page once it is empty. */
+static void
+zpool_free (struct zswap_entry *e) {
+	struct zpool_page *p = &pool[e->zpage];
+	uint64_t mask = e->chunk_cnt == ZCHUNK_CNT
+		? ~(uint64_t) 0 : ((uint64_t) 1 << e->chunk_cnt) - 1;
+
+	p->used &= ~(mask << e->chunk);
+	if (p->used == 0) {
+		palloc_free_page (p->kva);
+		p->kva = NULL;
+		pool_cnt--;
+	}
+}
+
+/* Forgets entry E. */
+static void
+zswap_remove (struct zswap_entry *e) {
+	list_remove (&e->lru_elem);
+	slot_map[e->slot] = NULL;
+	stored_bytes -= e->len;
+	stored_pages--;
+	zpool_free (e);
+	free (e);
+}
+
+/* Compresses the page at KVA into the pool as the contents of swap
+ * slot SLOT. Returns false if the page does not compress well or the
+ * pool has no room; the caller then writes it to the disk itself. */
+bool
+zswap_store (disk_sector_t slot, const void *kva) {
+	struct zswap_entry *e;
+	size_t len;
+
+	if (pool_max == 0)
+		return false;
+
+	lock_acquire (&zswap_lock);
+	ASSERT (slot_map[slot] == NULL);
+
+	len = lzf_compress (kva, PGSIZE, zbuf, sizeof zbuf);
+	e = len > 0 ? malloc (sizeof *e) : NULL;
+	if (e == NULL) {
+		reject_cnt++;
+		lock_release (&zswap_lock);
+		return false;
+	}
+	e->slot = slot;
+	e->len = len;
+	e->chunk_cnt = DIV_ROUND_UP (len, ZCHUNK);
+
+	/* Make room by pushing the oldest pages out to the disk. */
+	while (!zpool_alloc (e->chunk_cnt, &e->zpage, &e->chunk)) {
+		if (list_empty (&lru)) {
+			free (e);
+			reject_cnt++;
+			lock_release (&zswap_lock);
+			return false;
+		}
+		zswap_writeback ();
+	}
+
+	memcpy (pool[e->zpage].kva + e->chunk * ZCHUNK, zbuf, len);
+	slot_map[slot] = e;
+	list_push_back (&lru, &e->lru_elem);
+	stored_cnt++;
+	stored_pages++;
+	stored_bytes += len;
+	lock_release (&zswap_lock);
+	return true;
+}
+
+/* Decompresses the contents of swap slot SLOT into KVA. Returns false
+ * if zswap does not hold the slot. The slot stays stored until
+ * zswap_invalidate(), since several pages may share it. */
+bool
+zswap_load (disk_sector_t slot, void *kva) {
+	struct zswap_entry *e;
+	size_t len;
+
+	if (pool_max == 0)
+		return false;
+
+	lock_acquire (&zswap_lock);
+	e = slot_map[slot];
+	if (e == NULL) {
+		lock_release (&zswap_lock);
+		return false;
+	}
+	len = lzf_decompress (pool[e->zpage].kva + e->chunk * ZCHUNK, e->len,
+			kva, PGSIZE);
+	ASSERT (len == PGSIZE);
+	load_cnt++;
+	lock_release (&zswap_lock);
+	return true;
+}
+
+/* Returns true if zswap holds swap slot SLOT. */
+bool
+zswap_contains (disk_sector_t slot) {
+	bool res;
+
+	if (pool_max == 0)
+		return false;
+
+	lock_acquire (&zswap_lock);
+	res = slot_map[slot] != NULL;
+	lock_release (&zswap_lock);
+	return res;
+}
+
+/* Drops what zswap holds for swap slot SLOT, which is being freed. */
+void
+zswap_invalidate (disk_sector_t slot) {
+	if (pool_max == 0)
+		return;
+
+	lock_acquire (&zswap_lock);
+	if (slot_map[slot] != NULL)
+		zswap_remove (slot_map[slot]);
+	lock_release (&zswap_lock);
+}
+
+/* Writes the oldest stored page to its swap slot and drops it from
+ * the pool. Must be called with zswap_lock held, so that a load of
+ * the slot waits until the page is on the disk. */
+static void
+zswap_writeback (void) {
+	struct zswap_entry *e = list_entry (list_front (&lru),
+			struct zswap_entry, lru_elem);
+	size_t len;
+
+	len = lzf_decompress (pool[e->zpage].kva + e->chunk * ZCHUNK, e->len,
+			wb_page, PGSIZE);
+	ASSERT (len == PGSIZE);
+	disk_write_multiple (disk, e->slot * sectors_per_slot, wb_page,
+			sectors_per_slot);
+	writeback_cnt++;
+	zswap_remove (e);
+}
+
+/* Prints zswap statistics. */
+void
+zswap_print_stats (void) {
+	if (pool_max == 0)
+		return;
+	printf ("zswap: %lld pages stored, %lld loaded, %lld rejected, "
+			"%lld written back\n",
+			stored_cnt, load_cnt, reject_cnt, writeback_cnt);
+	if (stored_bytes > 0)
+		printf ("zswap: %lld pages in %zu pool pages, "
+				"compression ratio %lld.%02lld\n",
+				stored_pages, pool_cnt,
+				stored_pages * PGSIZE / stored_bytes,
+				stored_pages * PGSIZE * 100 / stored_bytes % 100);
+}
+
+/* LZF-style compressor: the output is a sequence of literal runs,
+ * a control byte below 32 followed by that many plus one bytes, and
+ * back references, a control byte holding the length minus two in
+ * its top 3 bits (7 meaning a length byte follows) and the high bits
+ * of the offset minus one, then the low byte of the offset. */
+
+#define LZF_HLOG 12
+#define LZF_MAX_LIT 32
+#define LZF_MAX_OFF (1 << 13)
+#define LZF_MAX_REF ((1 << 8) + (1 << 3))
+
+/* Position of the last 3-byte sequence with each hash, plus one, so
+ * that 0 means none. Used under zswap_lock. */
+static uint16_t htab[1 << LZF_HLOG];
+
+static inline unsigned
+lzf_hash (const uint8_t *p) {
+	uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+	return (v * 2654435761u) >> (32 - LZF_HLOG);
+}
+
+/* Compresses the IN_LEN bytes at IN into OUT, which has room for
+ * OUT_LEN bytes. Returns the compressed size, or 0 if it does not
+ * fit. */
+static size_t
+lzf_compress (const uint8_t *in, size_t in_len, uint8_t *out,
+		size_t out_len) {
+	const uint8_t *ip = in, *in_end = in + in_len;
+	uint8_t *op = out, *out_end = out + out_len;
+	size_t lit = 0;
+
+	memset (htab, 0, sizeof htab);
+	if (op >= out_end)
+		return 0;
+	op++;                       /* Control byte of the first run */
+
+	while (ip < in_end) {
+		if (ip + 2 < in_end) {
+			unsigned h = lzf_hash (ip);
+			const uint8_t *ref = htab[h] ? in + htab[h] - 1 : NULL;
+			size_t off;
+
+			htab[h] = ip - in + 1;
+			if (ref != NULL && (off = ip - ref - 1) < LZF_MAX_OFF
+					&& ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]) {
+				size_t len = 3, max = in_end - ip;
+
+				if (max > LZF_MAX_REF)
+					max = LZF_MAX_REF;
+				while (len < max && ref[len] == ip[len])
+					len++;
+
+				/* Close the literal run, dropping it if empty. */
+				op[-lit - 1] = lit - 1;
+				op -= !lit;
+				if (op + 3 + 1 > out_end)
+					return 0;
+				len -= 2;
+				if (len < 7)
+					*op++ = (off >> 8) + (len << 5);
+				else {
+					*op++ = (off >> 8) + (7 << 5);
+					*op++ = len - 7;
+				}
+				*op++ = off;
+				ip += len + 2;
+
+				lit = 0;
+				op++;           /* Control byte of the next run */
+				continue;
+			}
+		}
+
+		/* Literal byte. */
+		if (op + 1 > out_end)
+			return 0;
+		*op++ = *ip++;
+		if (++lit == LZF_MAX_LIT) {
+			op[-lit - 1] = lit - 1;
+			lit = 0;
+			if (op + 1 > out_end)
+				return 0;
+			op++;
+		}
+	}
+
+	op[-lit - 1] = lit - 1;
+	op -= !lit;
+	return op - out;
+}
+
+/* Decompresses the IN_LEN bytes at IN into OUT, which has room for
+ * OUT_LEN bytes. Returns the decompressed size, or 0 if the input is
+ * corrupt. */
+static size_t
+lzf_decompress (const uint8_t *in, size_t in_len, uint8_t *out,
+		size_t out_len) {
+	const uint8_t *ip = in, *in_end = in + in_len;
+	uint8_t *op = out, *out_end = out + out_len;
+
+	while (ip < in_end) {
+		unsigned ctrl = *ip++;
+
+		if (ctrl < LZF_MAX_LIT) {
+			size_t len = ctrl + 1;
+
+			if (ip + len > in_end || op + len > out_end)
+				return 0;
+			memcpy (op, ip, len);
+			op += len;
+			ip += len;
+		} else {
+			size_t len = ctrl >> 5;
+			const uint8_t *ref;
+
+			if (len == 7) {
+				if (ip >= in_end)
+					return 0;
+				len += *ip++;
+			}
+			len += 2;
+			if (ip >= in_end)
+				return 0;
+			ref = op - ((ctrl & 0x1f) << 8) - 1 - *ip++;
+			if (ref < out || op + len > out_end)
+				return 0;
+			/* The reference may overlap what it produces. */
+			while (len-- > 0)
+				*op++ = *ref++;
+		}
+	}
+	return op - out;
+}